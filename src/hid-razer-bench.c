@@ -0,0 +1,322 @@
+/*
+ * Razer Kernel Drivers
+ * Copyright (c) 2016 Roland Singer <roland.singer@desertbit.com>
+ * Based on Tim Theede <pez2001@voyagerproject.de> razer_chroma_drivers project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * KUnit benchmark of frame uploads. Included by hid-razer.c with
+ * CONFIG_HID_RAZER_KUNIT_TEST after hid-razer-test.c, whose helpers it
+ * uses. Runs every model on the software device emulator with every
+ * transport setting and prints the results to the test log.
+ * scripts/razer-bench runs the suite and shows the results.
+ */
+
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sort.h>
+
+//#################//
+//### Constants ###//
+//#################//
+
+// Frames uploaded per model and transport setting.
+#define RAZER_BENCH_FRAMES 200
+
+//#############//
+//### Types ###//
+//#############//
+
+// Transport setting of a benchmark run.
+// pacing_us: Initial value and upper bound of the learned gap.
+// policy:    Response policy of the frame command class.
+// busy:      BUSY responses of the emulator before every final status.
+// delay_us:  Duration of an emulated transfer.
+struct razer_bench_transport {
+	const char        *name;
+	uint              pacing_us;
+	enum razer_policy policy;
+	uint              busy;
+	uint              delay_us;
+};
+
+static const struct razer_bench_transport razer_bench_transports[] = {
+	{
+		.name      = "confirm, default gap",
+		.pacing_us = RAZER_PACING_DEFAULT_US,
+		.policy    = RAZER_POLICY_CONFIRM,
+	},
+	{
+		.name      = "deferred, default gap",
+		.pacing_us = RAZER_PACING_DEFAULT_US,
+		.policy    = RAZER_POLICY_DEFERRED,
+	},
+	{
+		.name      = "confirm, minimum gap",
+		.pacing_us = RAZER_PACING_MIN_US,
+		.policy    = RAZER_POLICY_CONFIRM,
+	},
+	{
+		.name      = "deferred, minimum gap",
+		.pacing_us = RAZER_PACING_MIN_US,
+		.policy    = RAZER_POLICY_DEFERRED,
+	},
+	{
+		.name      = "deferred, minimum gap, busy once",
+		.pacing_us = RAZER_PACING_MIN_US,
+		.policy    = RAZER_POLICY_DEFERRED,
+		.busy      = 1,
+	},
+	{
+		.name      = "deferred, minimum gap, 125us transfers",
+		.pacing_us = RAZER_PACING_MIN_US,
+		.policy    = RAZER_POLICY_DEFERRED,
+		.delay_us  = 125,
+	},
+};
+
+// In-flight depths of the batch runs.
+static const uint razer_bench_depths[] = { 1, 2, 4, RAZER_INFLIGHT_MAX };
+
+//########################//
+//### Helper functions ###//
+//########################//
+
+static int razer_bench_cmp(const void *a, const void *b)
+{
+	const u64 *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+// Returns the percentile p of sorted latencies in microseconds.
+static u64 razer_bench_percentile(u64 *latency, uint count, uint p)
+{
+	return div_u64(latency[(count * p + 99) / 100 - 1], NSEC_PER_USEC);
+}
+
+// Print the results of a run.
+// transfers: SET_REPORT and GET_REPORT transfers of the run.
+static void razer_bench_report(struct kunit *test, const char *name,
+			       u64 *latency, s64 elapsed_ns, uint transfers)
+{
+	uint per_frame = transfers * 100 / RAZER_BENCH_FRAMES;
+
+	sort(latency, RAZER_BENCH_FRAMES, sizeof(*latency), razer_bench_cmp,
+	     NULL);
+
+	kunit_info(test,
+		   "%s: %llu fps p50 %lluus p99 %lluus %u.%02u "
+		   "transfers/frame\n",
+		   name,
+		   div64_u64((u64)RAZER_BENCH_FRAMES * NSEC_PER_SEC,
+			     max_t(s64, elapsed_ns, 1)),
+		   razer_bench_percentile(latency, RAZER_BENCH_FRAMES, 50),
+		   razer_bench_percentile(latency, RAZER_BENCH_FRAMES, 99),
+		   per_frame / 100, per_frame % 100);
+}
+
+// Restore the emulator and apply the pacing of a run.
+// Settles the previous run first.
+static void razer_bench_reset(struct kunit *test, struct razer_emu *emu,
+			      uint pacing_us)
+{
+	struct razer_device *razer_dev = &emu->razer_dev;
+
+	razer_settle(razer_dev);
+	razer_get_sticky_error(razer_dev, true);
+	razer_emu_reset(emu);
+
+	KUNIT_ASSERT_EQ(test, razer_set_pacing_max(razer_dev, pacing_us), 0);
+	KUNIT_ASSERT_EQ(test, razer_set_pacing_gap(razer_dev, pacing_us), 0);
+}
+
+// Upload frames alternating between frame a and b with razer_set_key_colors
+// and print the frame rate, the commit latency and the transfers per frame.
+static void razer_bench_key_colors_run(struct kunit *test,
+				       struct razer_emu *emu,
+				       const struct razer_bench_transport *tr,
+				       const char *name, unsigned char *a,
+				       unsigned char *b, size_t len,
+				       u64 *latency)
+{
+	struct razer_device *razer_dev = &emu->razer_dev;
+	ktime_t begin, start;
+	uint transfers, i;
+	int retval;
+
+	razer_bench_reset(test, emu, tr->pacing_us);
+	KUNIT_ASSERT_EQ(test, razer_set_policy(razer_dev, 0x03, tr->policy), 0);
+
+	// Start from frame b on the device and in the shadow.
+	KUNIT_ASSERT_EQ(test, razer_set_key_colors(razer_dev, b, len), 0);
+	razer_settle(razer_dev);
+
+	emu->busy     = tr->busy;
+	emu->delay_us = tr->delay_us;
+	transfers     = emu->sends + emu->receives;
+	begin         = ktime_get();
+
+	for (i = 0; i < RAZER_BENCH_FRAMES; i++) {
+		start  = ktime_get();
+		retval = razer_set_key_colors(razer_dev, (i % 2) ? b : a, len);
+		latency[i] = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		KUNIT_ASSERT_EQ(test, retval, 0);
+	}
+
+	// The last deferred frame is part of the run.
+	razer_settle(razer_dev);
+
+	razer_bench_report(test, name, latency,
+			   ktime_to_ns(ktime_sub(ktime_get(), begin)),
+			   emu->sends + emu->receives - transfers);
+
+	KUNIT_EXPECT_EQ(test, razer_get_sticky_error(razer_dev, true), 0);
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 0);
+	KUNIT_EXPECT_EQ(test, emu->rejected, 0);
+	KUNIT_EXPECT_EQ(test, emu->interleaved, 0);
+}
+
+// Upload the rows of frames alternating between frame a and b as a batch
+// of requests with an in-flight depth.
+static void razer_bench_batch_run(struct kunit *test, struct razer_emu *emu,
+				  const struct razer_model *model, uint depth,
+				  const char *name, unsigned char *a,
+				  unsigned char *b, u64 *latency)
+{
+	struct razer_device *razer_dev = &emu->razer_dev;
+	size_t row_len                 = model->columns * 3;
+	struct razer_report *reports;
+	unsigned char *frame;
+	ktime_t begin, start;
+	uint transfers, i, row;
+	int *status;
+	int retval;
+
+	reports = kunit_kcalloc(test, model->rows, sizeof(*reports),
+				GFP_KERNEL);
+	status  = kunit_kcalloc(test, model->rows, sizeof(*status),
+				GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, reports);
+	KUNIT_ASSERT_NOT_NULL(test, status);
+
+	razer_bench_reset(test, emu, RAZER_PACING_MIN_US);
+	KUNIT_ASSERT_EQ(test, razer_set_inflight_depth(razer_dev, depth), 0);
+
+	transfers = emu->sends + emu->receives;
+	begin     = ktime_get();
+
+	for (i = 0; i < RAZER_BENCH_FRAMES; i++) {
+		frame = (i % 2) ? b : a;
+		start = ktime_get();
+
+		for (row = 0; row < model->rows; row++)
+			razer_fill_key_row_report(&reports[row], row, 0,
+						  model->columns - 1,
+						  &frame[row * row_len]);
+
+		retval = razer_send_batch(razer_dev, reports, status,
+					  model->rows);
+		latency[i] = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		KUNIT_ASSERT_EQ(test, retval, 0);
+	}
+
+	razer_bench_report(test, name, latency,
+			   ktime_to_ns(ktime_sub(ktime_get(), begin)),
+			   emu->sends + emu->receives - transfers);
+
+	KUNIT_EXPECT_EQ(test, emu->rows, RAZER_BENCH_FRAMES * model->rows);
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 0);
+}
+
+//##################//
+//### Benchmarks ###//
+//##################//
+
+// Full frames and single key changes with every transport setting.
+static void razer_bench_key_colors(struct kunit *test)
+{
+	const struct razer_model *model = test->param_value;
+	struct razer_emu *emu           = razer_test_device(test, model);
+	size_t len                      = model->rows * model->columns * 3;
+	unsigned char *a                = razer_test_frame(test, model, 0x00);
+	unsigned char *b                = razer_test_frame(test, model, 0xFF);
+	unsigned char *key              = razer_test_frame(test, model, 0xFF);
+	const struct razer_bench_transport *tr;
+	char name[128];
+	u64 *latency;
+	int i;
+
+	latency = kunit_kmalloc_array(test, RAZER_BENCH_FRAMES,
+				      sizeof(*latency), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, latency);
+
+	// Differs from frame b in a single key.
+	key[0] = 0x00;
+
+	for (i = 0; i < ARRAY_SIZE(razer_bench_transports); i++) {
+		tr = &razer_bench_transports[i];
+
+		snprintf(name, sizeof(name), "%s, %s, full frames",
+			 model->name, tr->name);
+		razer_bench_key_colors_run(test, emu, tr, name, a, b, len,
+					   latency);
+
+		snprintf(name, sizeof(name), "%s, %s, single key",
+			 model->name, tr->name);
+		razer_bench_key_colors_run(test, emu, tr, name, key, b, len,
+					   latency);
+	}
+}
+
+// Full frames sent row by row as a batch with every in-flight depth.
+static void razer_bench_batch(struct kunit *test)
+{
+	const struct razer_model *model = test->param_value;
+	struct razer_emu *emu           = razer_test_device(test, model);
+	unsigned char *a                = razer_test_frame(test, model, 0x00);
+	unsigned char *b                = razer_test_frame(test, model, 0xFF);
+	char name[128];
+	u64 *latency;
+	int i;
+
+	latency = kunit_kmalloc_array(test, RAZER_BENCH_FRAMES,
+				      sizeof(*latency), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, latency);
+
+	for (i = 0; i < ARRAY_SIZE(razer_bench_depths); i++) {
+		snprintf(name, sizeof(name), "%s, batch, inflight_depth %u",
+			 model->name, razer_bench_depths[i]);
+		razer_bench_batch_run(test, emu, model, razer_bench_depths[i],
+				      name, a, b, latency);
+	}
+}
+
+static struct kunit_case razer_bench_cases[] = {
+	KUNIT_CASE_PARAM_ATTR(razer_bench_key_colors,
+			      razer_test_model_gen_params,
+			      { .speed = KUNIT_SPEED_SLOW }),
+	KUNIT_CASE_PARAM_ATTR(razer_bench_batch, razer_test_model_gen_params,
+			      { .speed = KUNIT_SPEED_SLOW }),
+	{}
+};
+
+static struct kunit_suite razer_bench_suite = {
+	.name       = "hid-razer-bench",
+	.exit       = razer_test_exit,
+	.test_cases = razer_bench_cases,
+};
+
+kunit_test_suite(razer_bench_suite);
@@ -0,0 +1,534 @@
+/*
+ * Razer Kernel Drivers
+ * Copyright (c) 2016 Roland Singer <roland.singer@desertbit.com>
+ * Based on Tim Theede <pez2001@voyagerproject.de> razer_chroma_drivers project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * KUnit suite of the report transport. Included by hid-razer-common.c
+ * with CONFIG_HID_RAZER_KUNIT_TEST, so the static helpers can be tested.
+ * Runs against the software device emulator.
+ */
+
+#include <kunit/test.h>
+
+#include "hid-razer-emu.h"
+
+//########################//
+//### Helper functions ###//
+//########################//
+
+/*
+ * Get a request of a command with a valid checksum.
+ */
+static struct razer_report razer_test_request(unsigned char command_class,
+					      unsigned char command_id)
+{
+	struct razer_report report = razer_new_report();
+
+	report.command_class = command_class;
+	report.command_id    = command_id;
+	report.data_size     = 0x02;
+	report.crc           = razer_calculate_crc(&report);
+
+	return report;
+}
+
+/*
+ * Fill a custom frame report setting the columns start-end of a row to
+ * a single value.
+ */
+static void razer_test_row_report(struct razer_report *report,
+				  unsigned char row, unsigned char start,
+				  unsigned char end, unsigned char value)
+{
+	uint len = (end - start + 1) * 3;
+
+	*report = razer_new_report();
+	report->transaction_id = 0x80;
+	report->command_class  = 0x03;
+	report->command_id     = 0x0B;
+	report->data_size      = len + 4;
+	report->arguments[0]   = 0xFF;
+	report->arguments[1]   = row;
+	report->arguments[2]   = start;
+	report->arguments[3]   = end;
+	memset(&report->arguments[4], value, len);
+	report->crc            = razer_calculate_crc(report);
+}
+
+/*
+ * Preempt callback ending the frame with the second report.
+ * context counts the calls.
+ */
+static bool razer_test_preempt(struct razer_device *razer_dev, void *context)
+{
+	uint *calls = context;
+
+	return ++(*calls) == 2;
+}
+
+static int razer_common_test_init(struct kunit *test)
+{
+	struct razer_emu *emu;
+	int retval;
+
+	emu = kunit_kzalloc(test, sizeof(*emu), GFP_KERNEL);
+	if (!emu)
+		return -ENOMEM;
+
+	retval = razer_emu_init(emu);
+	if (retval != 0)
+		return retval;
+
+	test->priv = emu;
+
+	return 0;
+}
+
+static void razer_common_test_exit(struct kunit *test)
+{
+	if (test->priv)
+		razer_emu_deinit(test->priv);
+}
+
+//################//
+//### Checksum ###//
+//################//
+
+/*
+ * The word-wide XOR fold matches the byte loop for all lengths and
+ * alignments.
+ */
+static void razer_test_xor_fold(struct kunit *test)
+{
+	unsigned char data[48], expected;
+	uint offset, len, i;
+
+	get_random_bytes(data, sizeof(data));
+
+	for (offset = 0; offset < 8; offset++) {
+		for (len = 0; offset + len <= sizeof(data); len++) {
+			expected = 0;
+			for (i = 0; i < len; i++)
+				expected ^= data[offset + i];
+
+			KUNIT_EXPECT_EQ(test,
+					razer_xor_fold(&data[offset], len),
+					expected);
+		}
+	}
+}
+
+/*
+ * razer_calculate_crc matches the reference byte loop.
+ */
+static void razer_test_crc(struct kunit *test)
+{
+	struct razer_report report;
+	uint i;
+
+	for (i = 0; i < RAZER_CRC_SELFTEST_ROUNDS; i++) {
+		get_random_bytes(&report, sizeof(report));
+		KUNIT_EXPECT_EQ(test, razer_calculate_crc(&report),
+				razer_calculate_crc_ref(&report));
+	}
+
+	// Status, transaction id, CRC and reserved byte are not covered.
+	memset(&report, 0, sizeof(report));
+	report.status         = 0x02;
+	report.transaction_id = 0xFF;
+	report.crc            = 0x55;
+	report.reserved       = 0xAA;
+	KUNIT_EXPECT_EQ(test, razer_calculate_crc(&report), 0);
+}
+
+/*
+ * razer_update_crc gives the checksum of the changed report.
+ */
+static void razer_test_crc_update(struct kunit *test)
+{
+	struct razer_report report;
+	unsigned char old[32], crc;
+	uint len;
+
+	get_random_bytes(&report, sizeof(report));
+	crc = razer_calculate_crc(&report);
+
+	for (len = 1; len <= sizeof(old); len++) {
+		memcpy(old, &report.arguments[len], len);
+		get_random_bytes(&report.arguments[len], len);
+
+		crc = razer_update_crc(crc, old, &report.arguments[len], len);
+		KUNIT_ASSERT_EQ(test, crc, razer_calculate_crc_ref(&report));
+	}
+}
+
+//#################//
+//### Transport ###//
+//#################//
+
+/*
+ * A request answered with SUCCESS costs one transfer each way.
+ */
+static void razer_test_send_success(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report request  = razer_test_request(0x00, 0x81);
+	struct razer_report response;
+
+	KUNIT_EXPECT_EQ(test, razer_send_with_response(&emu->razer_dev,
+						       &request, &response),
+			0);
+	KUNIT_EXPECT_EQ(test, response.status, RAZER_STATUS_SUCCESS);
+	KUNIT_EXPECT_EQ(test, response.command_class, 0x00);
+	KUNIT_EXPECT_EQ(test, response.command_id, 0x81);
+	KUNIT_EXPECT_EQ(test, emu->sends, 1);
+	KUNIT_EXPECT_EQ(test, emu->receives, 1);
+}
+
+/*
+ * BUSY responses are polled again until the final status arrives.
+ */
+static void razer_test_busy_retry(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report request = razer_test_request(0x00, 0x81);
+	struct razer_report response;
+	struct razer_stats stats;
+	u64 polls[RAZER_POLL_BUCKETS];
+
+	emu->busy = 3;
+
+	KUNIT_EXPECT_EQ(test, razer_send_with_response(&emu->razer_dev,
+						       &request, &response),
+			0);
+	KUNIT_EXPECT_EQ(test, response.status, RAZER_STATUS_SUCCESS);
+	KUNIT_EXPECT_EQ(test, emu->sends, 1);
+	KUNIT_EXPECT_EQ(test, emu->receives, 4);
+
+	razer_get_stats(&emu->razer_dev, &stats);
+	KUNIT_EXPECT_EQ(test, stats.retries, 3);
+	KUNIT_EXPECT_EQ(test, stats.status[RAZER_STATUS_BUSY], 3);
+
+	// Three polls fall into the 3-4 bucket.
+	razer_get_busy_polls(&emu->razer_dev, polls);
+	KUNIT_EXPECT_EQ(test, polls[3], 1);
+}
+
+/*
+ * A device staying BUSY fails the request after the deadline.
+ */
+static void razer_test_busy_deadline(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report request = razer_test_request(0x00, 0x81);
+	struct razer_report response;
+	struct razer_backoff backoff = {
+		.initial_us  = 100,
+		.max_us      = 400,
+		.deadline_ms = 5,
+	};
+
+	KUNIT_ASSERT_EQ(test, razer_set_backoff(&emu->razer_dev, 0x00,
+						&backoff), 0);
+	emu->busy = UINT_MAX;
+
+	KUNIT_EXPECT_EQ(test, razer_send_with_response(&emu->razer_dev,
+						       &request, &response),
+			-EBUSY);
+	KUNIT_EXPECT_GT(test, emu->receives, 1);
+}
+
+/*
+ * A BUSY response doubles the gap, a streak of SUCCESS shrinks it.
+ */
+static void razer_test_busy_pacing(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report request = razer_test_request(0x00, 0x81);
+	struct razer_report response;
+	uint gap, i;
+
+	KUNIT_ASSERT_EQ(test, razer_set_pacing_gap(&emu->razer_dev, 400), 0);
+
+	emu->busy = 1;
+	KUNIT_EXPECT_EQ(test, razer_send_with_response(&emu->razer_dev,
+						       &request, &response),
+			0);
+	KUNIT_EXPECT_EQ(test, razer_get_pacing_gap(&emu->razer_dev), 800);
+
+	emu->busy = 0;
+	for (i = 0; i < RAZER_PACING_STREAK; i++)
+		KUNIT_ASSERT_EQ(test,
+				razer_send_with_response(&emu->razer_dev,
+							 &request, &response),
+				0);
+
+	gap = razer_get_pacing_gap(&emu->razer_dev);
+	KUNIT_EXPECT_EQ(test, gap, 800 - 800 / 8);
+}
+
+/*
+ * FAILURE, TIMEOUT and NOT_SUPPORTED fail the request.
+ */
+static void razer_test_status_failure(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report request = razer_test_request(0x00, 0x81);
+	struct razer_report response;
+	int i;
+
+	emu->script[0]  = RAZER_STATUS_FAILURE;
+	emu->script[1]  = RAZER_STATUS_TIMEOUT;
+	emu->script[2]  = RAZER_STATUS_NOT_SUPPORTED;
+	emu->script_len = 3;
+
+	for (i = 0; i < 3; i++)
+		KUNIT_EXPECT_EQ(test,
+				razer_send_with_response(&emu->razer_dev,
+							 &request, &response),
+				-EINVAL);
+
+	KUNIT_EXPECT_EQ(test, razer_send_with_response(&emu->razer_dev,
+						       &request, &response),
+			0);
+}
+
+/*
+ * Transfer errors are passed on. A failed receive zeroes the response.
+ */
+static void razer_test_transport_error(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report request = razer_test_request(0x00, 0x81);
+	struct razer_report response;
+
+	emu->send_error = -EPIPE;
+	KUNIT_EXPECT_EQ(test, razer_send_with_response(&emu->razer_dev,
+						       &request, &response),
+			-EPIPE);
+	KUNIT_EXPECT_EQ(test, emu->receives, 0);
+
+	emu->send_error    = 0;
+	emu->receive_error = -EPROTO;
+	memset(&response, 0xFF, sizeof(response));
+	KUNIT_EXPECT_EQ(test, razer_send_with_response(&emu->razer_dev,
+						       &request, &response),
+			-EPROTO);
+	KUNIT_EXPECT_EQ(test, response.status, 0);
+	KUNIT_EXPECT_EQ(test, response.command_id, 0);
+}
+
+/*
+ * The device rejects a report with a wrong checksum.
+ */
+static void razer_test_bad_crc(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report request = razer_test_request(0x00, 0x81);
+	struct razer_report response;
+
+	request.crc ^= 0x01;
+
+	KUNIT_EXPECT_EQ(test, razer_send_with_response(&emu->razer_dev,
+						       &request, &response),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 1);
+}
+
+//##############//
+//### Frames ###//
+//##############//
+
+/*
+ * A frame is one sequence counting down to 0 and confirmed once.
+ */
+static void razer_test_frame(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report reports[4];
+	int i;
+
+	KUNIT_ASSERT_EQ(test, razer_set_policy(&emu->razer_dev, 0x03,
+					       RAZER_POLICY_CONFIRM), 0);
+
+	for (i = 0; i < ARRAY_SIZE(reports); i++)
+		razer_test_row_report(&reports[i], i, 0, 15, i + 1);
+
+	KUNIT_EXPECT_EQ(test, razer_send_frame(&emu->razer_dev, reports,
+					       ARRAY_SIZE(reports)), 0);
+	KUNIT_EXPECT_EQ(test, emu->sends, 4);
+	KUNIT_EXPECT_EQ(test, emu->receives, 1);
+	KUNIT_EXPECT_EQ(test, emu->rows, 4);
+	KUNIT_EXPECT_EQ(test, emu->sequences, 1);
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 0);
+
+	for (i = 0; i < ARRAY_SIZE(reports); i++) {
+		KUNIT_EXPECT_EQ(test, emu->matrix[i][0], i + 1);
+		KUNIT_EXPECT_EQ(test, emu->matrix[i][15 * 3 + 2], i + 1);
+		KUNIT_EXPECT_EQ(test, emu->matrix[i][16 * 3], 0);
+	}
+}
+
+/*
+ * A preempted frame ends with a complete sequence. The rest is sent as
+ * a sequence of its own.
+ */
+static void razer_test_frame_preempt(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report reports[4], request;
+	uint calls = 0, sent;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(reports); i++)
+		razer_test_row_report(&reports[i], i, 0, 15, i + 1);
+
+	KUNIT_EXPECT_EQ(test, razer_send_frame_preemptible(&emu->razer_dev,
+							   reports, 4,
+							   razer_test_preempt,
+							   &calls, &sent), 0);
+	KUNIT_EXPECT_EQ(test, sent, 2);
+	KUNIT_EXPECT_EQ(test, emu->sequences, 1);
+	KUNIT_EXPECT_FALSE(test, emu->seq_open);
+
+	// The interactive request between both parts.
+	request = razer_test_request(0x0E, 0x04);
+	KUNIT_EXPECT_EQ(test, razer_send_check_response(&emu->razer_dev,
+							&request), 0);
+
+	KUNIT_EXPECT_EQ(test, razer_send_frame(&emu->razer_dev, &reports[2],
+					       2), 0);
+	KUNIT_EXPECT_EQ(test, emu->sequences, 2);
+	KUNIT_EXPECT_EQ(test, emu->rows, 4);
+	KUNIT_EXPECT_EQ(test, emu->interleaved, 0);
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 0);
+}
+
+/*
+ * A failed deferred request is reported by the next settle.
+ */
+static void razer_test_deferred_failure(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report report;
+
+	KUNIT_ASSERT_EQ(test, razer_get_policy(&emu->razer_dev, 0x03),
+			RAZER_POLICY_DEFERRED);
+
+	razer_test_row_report(&report, 0, 0, 3, 0x10);
+	emu->script[0]  = RAZER_STATUS_FAILURE;
+	emu->script_len = 1;
+
+	KUNIT_EXPECT_EQ(test, razer_send_check_response(&emu->razer_dev,
+							&report), 0);
+	KUNIT_EXPECT_EQ(test, emu->receives, 0);
+
+	KUNIT_EXPECT_EQ(test, razer_settle(&emu->razer_dev), 1);
+	KUNIT_EXPECT_EQ(test, emu->receives, 1);
+	KUNIT_EXPECT_EQ(test, razer_get_sticky_error(&emu->razer_dev, true),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_get_sticky_error(&emu->razer_dev, false),
+			0);
+}
+
+/*
+ * A deferred request is settled before the next deferred one replaces it,
+ * so the failure of the first one is not lost.
+ */
+static void razer_test_deferred_back_to_back(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report first  = razer_test_request(0x03, 0x0A);
+	struct razer_report second = razer_test_request(0x03, 0x0A);
+
+	emu->script[0]  = RAZER_STATUS_FAILURE;
+	emu->script[1]  = RAZER_STATUS_SUCCESS;
+	emu->script_len = 2;
+
+	KUNIT_EXPECT_EQ(test, razer_send_check_response(&emu->razer_dev,
+							&first), 0);
+	KUNIT_EXPECT_EQ(test, razer_send_check_response(&emu->razer_dev,
+							&second), 0);
+	KUNIT_EXPECT_EQ(test, emu->receives, 1);
+	KUNIT_EXPECT_EQ(test, razer_get_sticky_error(&emu->razer_dev, false),
+			-EINVAL);
+
+	KUNIT_EXPECT_EQ(test, razer_settle(&emu->razer_dev), 1);
+	KUNIT_EXPECT_EQ(test, emu->receives, 2);
+}
+
+//###############//
+//### Batches ###//
+//###############//
+
+/*
+ * Tagged requests in flight get their own results.
+ */
+static void razer_test_batch_tagged(struct kunit *test)
+{
+	struct razer_emu *emu = test->priv;
+	struct razer_report reports[6];
+	int status[ARRAY_SIZE(reports)];
+	int i;
+
+	KUNIT_ASSERT_EQ(test, razer_set_inflight_depth(&emu->razer_dev, 4), 0);
+
+	for (i = 0; i < ARRAY_SIZE(reports); i++)
+		reports[i] = razer_test_request(0x00, 0x81);
+
+	emu->busy       = 1;
+	emu->script[0]  = RAZER_STATUS_SUCCESS;
+	emu->script[1]  = RAZER_STATUS_SUCCESS;
+	emu->script[2]  = RAZER_STATUS_FAILURE;
+	emu->script_len = 3;
+
+	KUNIT_EXPECT_EQ(test, razer_send_batch(&emu->razer_dev, reports,
+					       status, ARRAY_SIZE(reports)),
+			-EINVAL);
+
+	for (i = 0; i < ARRAY_SIZE(reports); i++)
+		KUNIT_EXPECT_EQ(test, status[i], (i == 2) ? -EINVAL : 0);
+
+	KUNIT_EXPECT_EQ(test, emu->sends, ARRAY_SIZE(reports));
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 0);
+}
+
+static struct kunit_case razer_common_test_cases[] = {
+	KUNIT_CASE(razer_test_xor_fold),
+	KUNIT_CASE(razer_test_crc),
+	KUNIT_CASE(razer_test_crc_update),
+	KUNIT_CASE(razer_test_send_success),
+	KUNIT_CASE(razer_test_busy_retry),
+	KUNIT_CASE(razer_test_busy_deadline),
+	KUNIT_CASE(razer_test_busy_pacing),
+	KUNIT_CASE(razer_test_status_failure),
+	KUNIT_CASE(razer_test_transport_error),
+	KUNIT_CASE(razer_test_bad_crc),
+	KUNIT_CASE(razer_test_frame),
+	KUNIT_CASE(razer_test_frame_preempt),
+	KUNIT_CASE(razer_test_deferred_failure),
+	KUNIT_CASE(razer_test_deferred_back_to_back),
+	KUNIT_CASE(razer_test_batch_tagged),
+	{}
+};
+
+static struct kunit_suite razer_common_test_suite = {
+	.name       = "hid-razer-common",
+	.init       = razer_common_test_init,
+	.exit       = razer_common_test_exit,
+	.test_cases = razer_common_test_cases,
+};
+
+kunit_test_suite(razer_common_test_suite);
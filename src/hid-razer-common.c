@@ -21,233 +21,1417 @@
 #include <linux/init.h>
 #include <linux/usb/input.h>
 #include <linux/hid.h>
+#include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/random.h>
+#include <linux/percpu.h>
 
 #include "hid-razer-common.h"
 
+#define CREATE_TRACE_POINTS
+#include "hid-razer-trace.h"
+
 //###########################//
 //### Version Information ###//
 //###########################//
 
-MODULE_AUTHOR("Roland Singer <roland.singer@desertbit.com>");
-MODULE_DESCRIPTION("USB Razer common driver");
-MODULE_LICENSE("GPL v2");
-MODULE_VERSION("1.0.0");
+MODULE_AUTHOR("Roland Singer <roland.singer@desertbit.com>");
+MODULE_DESCRIPTION("USB Razer common driver");
+MODULE_LICENSE("GPL v2");
+MODULE_VERSION("1.0.0");
+
+// Checksummed byte range of a report: [start, end).
+#define RAZER_CRC_START  2
+#define RAZER_CRC_END    88
+
+// Random reports compared against the reference checksum at load time.
+#define RAZER_CRC_SELFTEST_ROUNDS  64
+
+// debugfs directory holding one directory per device.
+static struct dentry *razer_debugfs_root;
+
+//########################//
+//### Helper functions ###//
+//########################//
+
+/*
+ * Send a report with a SET_REPORT control transfer.
+ * buf must be DMA-safe.
+ */
+static int razer_usb_send(struct razer_device *razer_dev,
+			  struct razer_report *buf)
+{
+	const uint size = sizeof(*buf);
+	int len;
+
+	len =
+	usb_control_msg(razer_dev->usb_dev,
+			usb_sndctrlpipe(razer_dev->usb_dev, 0),
+			HID_REQ_SET_REPORT,                        // Request
+			USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_DIR_OUT,
+			0x300,                                     // Value
+			razer_dev->report_index,                   // Index
+			buf,                                       // Data
+			size,                                      // Length
+			USB_CTRL_SET_TIMEOUT);
+
+	return ((len < 0) ? len : ((len != size) ? -EIO : 0));
+}
+
+/*
+ * Fetch a report with a GET_REPORT control transfer.
+ * buf must be DMA-safe.
+ */
+static int razer_usb_receive(struct razer_device *razer_dev,
+			     struct razer_report *buf)
+{
+	const uint size = sizeof(*buf);
+	int len;
+
+	len =
+	usb_control_msg(razer_dev->usb_dev,
+			usb_rcvctrlpipe(razer_dev->usb_dev, 0),
+			HID_REQ_GET_REPORT,                          // Request
+			USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_DIR_IN,
+			0x300,                                       // Value
+			razer_dev->report_index,                     // Index
+			buf,                                         // Data
+			size,
+			USB_CTRL_SET_TIMEOUT);
+
+	return ((len < 0) ? len : ((len != size) ? -EIO : 0));
+}
+
+static const struct razer_transport_ops razer_usb_ops = {
+	.send    = razer_usb_send,
+	.receive = razer_usb_receive,
+};
+
+/*
+ * Sleep for the given amount of microseconds.
+ * Short delays use hrtimers, long ones msleep.
+ */
+static void razer_sleep_us(struct razer_device *razer_dev, uint us)
+{
+	ktime_t start;
+
+	if (us == 0)
+		return;
+
+	start = ktime_get();
+
+	if (us < 20000)
+		usleep_range(us, us + us / 4 + 1);
+	else
+		msleep(DIV_ROUND_UP(us, 1000));
+
+	this_cpu_add(razer_dev->stats->sleep_ns,
+		     ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+/*
+ * Add a duration to a latency histogram.
+ * Must be called with razer_device.lock held.
+ */
+static void razer_account_latency(struct razer_device *razer_dev,
+				  enum razer_latency_kind kind, s64 ns)
+{
+	u64 us      = (ns > 0) ? div_u64(ns, NSEC_PER_USEC) : 0;
+	uint bucket = min_t(uint, fls64(us), RAZER_LATENCY_BUCKETS - 1);
+
+	razer_dev->latency.hist[kind][bucket]++;
+}
+
+/*
+ * Lock the device and account the time spent waiting for the lock.
+ */
+static void razer_lock(struct razer_device *razer_dev)
+{
+	ktime_t start = ktime_get();
+
+	mutex_lock(&razer_dev->lock);
+
+	razer_dev->latency.request_open = false;
+	razer_dev->latency.lock_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	razer_account_latency(razer_dev, RAZER_LATENCY_LOCK,
+			      razer_dev->latency.lock_ns);
+	this_cpu_add(razer_dev->stats->lock_wait_ns,
+		     razer_dev->latency.lock_ns);
+}
+
+/*
+ * Wait until the learned gap since the last transfer elapsed.
+ * Must be called with razer_device.lock held.
+ * Returns the time waited in nanoseconds.
+ */
+static s64 razer_pace(struct razer_device *razer_dev)
+{
+	struct razer_pacing *pacing = &razer_dev->pacing;
+	ktime_t start               = ktime_get();
+	s64 elapsed, waited;
+
+	elapsed = ktime_us_delta(start, pacing->last_transfer);
+	if (elapsed >= 0 && elapsed < pacing->gap_us)
+		razer_sleep_us(razer_dev, pacing->gap_us - (uint)elapsed);
+
+	waited = ktime_to_ns(ktime_sub(ktime_get(), start));
+	razer_account_latency(razer_dev, RAZER_LATENCY_PACE, waited);
+
+	return waited;
+}
+
+/*
+ * Let the next transfer start without waiting for the gap.
+ * Used once the device confirmed that it finished a command.
+ */
+static void razer_pace_skip(struct razer_device *razer_dev)
+{
+	razer_dev->pacing.last_transfer = ktime_set(0, 0);
+}
+
+/*
+ * Remember the end of a transfer for the next razer_pace call.
+ */
+static void razer_pace_done(struct razer_device *razer_dev)
+{
+	razer_dev->pacing.last_transfer = ktime_get();
+}
+
+/*
+ * The device answered a request immediately with SUCCESS.
+ * Shrink the gap after a streak of such responses.
+ */
+static void razer_pacing_success(struct razer_device *razer_dev)
+{
+	struct razer_pacing *pacing = &razer_dev->pacing;
+
+	if (++pacing->streak < RAZER_PACING_STREAK)
+		return;
+
+	pacing->streak = 0;
+	pacing->gap_us = max_t(uint, pacing->gap_us - pacing->gap_us / 8,
+			       RAZER_PACING_MIN_US);
+}
+
+/*
+ * The device answered a request with BUSY. Back off.
+ */
+static void razer_pacing_busy(struct razer_device *razer_dev)
+{
+	struct razer_pacing *pacing = &razer_dev->pacing;
+
+	pacing->streak = 0;
+	pacing->gap_us = min(pacing->gap_us * 2, pacing->max_us);
+}
+
+/*
+ * Get the busy schedule for a command class.
+ * Must be called with razer_device.lock held.
+ */
+static void razer_lookup_backoff(struct razer_device *razer_dev,
+				 unsigned char command_class,
+				 struct razer_backoff *backoff)
+{
+	if (command_class < RAZER_BACKOFF_CLASSES) {
+		*backoff = razer_dev->backoff[command_class];
+		return;
+	}
+
+	backoff->initial_us  = RAZER_BACKOFF_INITIAL_US;
+	backoff->max_us      = RAZER_BACKOFF_MAX_US;
+	backoff->deadline_ms = RAZER_BACKOFF_DEADLINE_MS;
+}
+
+/*
+ * Account the number of BUSY polls a request needed.
+ * Must be called with razer_device.lock held.
+ */
+static void razer_count_polls(struct razer_device *razer_dev, uint polls)
+{
+	uint bucket = 0;
+
+	if (polls > 0)
+		bucket = min(1 + fls(polls - 1), RAZER_POLL_BUCKETS - 1);
+
+	razer_dev->busy_polls[bucket]++;
+}
+
+/*
+ * XOR len bytes to a single byte. Works on eight bytes per step.
+ */
+static unsigned char razer_xor_fold(const void *data, uint len)
+{
+	const unsigned char *p = data;
+	unsigned char tail     = 0;
+	u64 word, acc          = 0;
+
+	for (; len >= sizeof(word); len -= sizeof(word), p += sizeof(word)) {
+		memcpy(&word, p, sizeof(word));  // Unaligned load.
+		acc ^= word;
+	}
+
+	while (len--)
+		tail ^= *p++;
+
+	acc ^= acc >> 32;
+	acc ^= acc >> 16;
+	acc ^= acc >> 8;
+
+	return (unsigned char)acc ^ tail;
+}
+
+/*
+ * Reference checksum calculation one byte at a time.
+ * Used by the self-test of razer_calculate_crc.
+ */
+static unsigned char razer_calculate_crc_ref(struct razer_report *report)
+{
+	unsigned char crc = 0;
+	unsigned char *_report = (unsigned char *)report;
+	unsigned int i;
+
+	for (i = RAZER_CRC_START; i < RAZER_CRC_END; i++)
+		crc ^= _report[i];
+
+	return crc;
+}
+
+/*
+ * Compare the checksum functions against the reference on random reports.
+ * Returns 0 on success.
+ */
+static int razer_crc_selftest(void)
+{
+	struct razer_report report;
+	unsigned char old[16], crc;
+	uint i, offset, len;
+
+	for (i = 0; i < RAZER_CRC_SELFTEST_ROUNDS; i++) {
+		get_random_bytes(&report, sizeof(report));
+
+		crc = razer_calculate_crc(&report);
+		if (crc != razer_calculate_crc_ref(&report))
+			goto exit_mismatch;
+
+		// Change a random slice of the arguments.
+		offset = get_random_u32() % sizeof(report.arguments);
+		len    = 1 + get_random_u32() %
+			 min_t(uint, sizeof(old),
+			       sizeof(report.arguments) - offset);
+
+		memcpy(old, &report.arguments[offset], len);
+		get_random_bytes(&report.arguments[offset], len);
+
+		crc = razer_update_crc(crc, old, &report.arguments[offset], len);
+		if (crc != razer_calculate_crc_ref(&report))
+			goto exit_mismatch;
+	}
+
+	return 0;
+
+exit_mismatch:
+	pr_err("hid-razer-common: checksum self-test failed\n");
+	return -EINVAL;
+}
+
+/*
+ * Print the latency histograms of a device.
+ */
+static int razer_latency_show(struct seq_file *m, void *unused)
+{
+	struct razer_device *razer_dev = m->private;
+	struct razer_latency *latency;
+	uint i;
+
+	latency = kmalloc(sizeof(*latency), GFP_KERNEL);
+	if (!latency)
+		return -ENOMEM;
+
+	mutex_lock(&razer_dev->lock);
+	memcpy(latency, &razer_dev->latency, sizeof(*latency));
+	mutex_unlock(&razer_dev->lock);
+
+	seq_puts(m, "us lock pace send receive request\n");
+
+	for (i = 0; i < RAZER_LATENCY_BUCKETS; i++) {
+		seq_printf(m, "%u %llu %llu %llu %llu %llu\n",
+			   (i == 0) ? 0 : 1U << (i - 1),
+			   latency->hist[RAZER_LATENCY_LOCK][i],
+			   latency->hist[RAZER_LATENCY_PACE][i],
+			   latency->hist[RAZER_LATENCY_SEND][i],
+			   latency->hist[RAZER_LATENCY_RECEIVE][i],
+			   latency->hist[RAZER_LATENCY_REQUEST][i]);
+	}
+
+	kfree(latency);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(razer_latency);
+
+//##########################//
+//### Exported Functions ###//
+//##########################//
+
+/*
+ * Initialize a razer device struct.
+ * Call razer_deinit_device to release the allocated resources.
+ */
+int razer_init_device(struct razer_device *razer_dev,
+		      struct usb_device *usb_dev)
+{
+	int i;
+
+	razer_dev->data     = NULL;
+	razer_dev->usb_dev  = usb_dev;
+	razer_dev->ops      = &razer_usb_ops;
+	mutex_init(&razer_dev->lock);
+
+	razer_dev->pacing.gap_us        = RAZER_PACING_DEFAULT_US;
+	razer_dev->pacing.max_us        = RAZER_PACING_MAX_US;
+	razer_dev->pacing.streak        = 0;
+	razer_dev->pacing.last_transfer = ktime_set(0, 0);
+
+	memset(&razer_dev->latency, 0, sizeof(razer_dev->latency));
+	razer_dev->debugfs = NULL;
+
+	for (i = 0; i < RAZER_BACKOFF_CLASSES; i++) {
+		razer_dev->backoff[i].initial_us  = RAZER_BACKOFF_INITIAL_US;
+		razer_dev->backoff[i].max_us      = RAZER_BACKOFF_MAX_US;
+		razer_dev->backoff[i].deadline_ms = RAZER_BACKOFF_DEADLINE_MS;
+	}
+	memset(razer_dev->busy_polls, 0, sizeof(razer_dev->busy_polls));
+
+	// Key colors and effects are sent without waiting for each response.
+	for (i = 0; i < RAZER_POLICY_CLASSES; i++)
+		razer_dev->policy[i] = RAZER_POLICY_CONFIRM;
+	razer_dev->policy[0x03]     = RAZER_POLICY_DEFERRED;
+	razer_dev->has_outstanding  = false;
+	razer_dev->sticky_error     = 0;
+	razer_dev->deferred_failures = 0;
+
+	memset(razer_dev->inflight, 0, sizeof(razer_dev->inflight));
+	razer_dev->inflight_depth = 1;
+	razer_dev->inflight_count = 0;
+	razer_dev->next_tag       = RAZER_TAG_FIRST;
+
+	// Reports often live on the stack, which is not DMA-safe.
+	// Transfers go through this buffer instead.
+	razer_dev->xfer_buf = kzalloc(sizeof(*razer_dev->xfer_buf),
+				      GFP_KERNEL);
+	if (!razer_dev->xfer_buf)
+		return -ENOMEM;
+
+	razer_dev->stats = alloc_percpu(struct razer_stats);
+	if (!razer_dev->stats) {
+		kfree(razer_dev->xfer_buf);
+		razer_dev->xfer_buf = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(razer_init_device);
+
+/*
+ * Release the resources of a razer device struct.
+ */
+void razer_deinit_device(struct razer_device *razer_dev)
+{
+	debugfs_remove_recursive(razer_dev->debugfs);
+	razer_dev->debugfs = NULL;
+
+	free_percpu(razer_dev->stats);
+	razer_dev->stats = NULL;
+
+	kfree(razer_dev->xfer_buf);
+	razer_dev->xfer_buf = NULL;
+}
+EXPORT_SYMBOL_GPL(razer_deinit_device);
+
+/*
+ * Create the debugfs directory razer/<name> of a device.
+ * It is removed by razer_deinit_device. Failures are not fatal.
+ */
+void razer_create_debugfs(struct razer_device *razer_dev, const char *name)
+{
+	razer_dev->debugfs = debugfs_create_dir(name, razer_debugfs_root);
+	debugfs_create_file("latency", 0444, razer_dev->debugfs, razer_dev,
+			    &razer_latency_fops);
+}
+EXPORT_SYMBOL_GPL(razer_create_debugfs);
+
+/*
+ * Get an initialised razer report
+ */
+struct razer_report razer_new_report(void)
+{
+	struct razer_report new_report;
+
+	memset(&new_report, 0, sizeof(new_report));
+
+	new_report.status             = RAZER_STATUS_NEW_COMMAND;
+	new_report.transaction_id     = 0xFF;
+	new_report.remaining_packets  = 0x00;
+	new_report.protocol_type      = 0x00;
+	new_report.reserved           = 0x00;
+	new_report.command_class      = 0x00;
+	new_report.command_id         = 0x00;
+	new_report.data_size          = 0x00;
+
+	return new_report;
+}
+EXPORT_SYMBOL_GPL(razer_new_report);
+
+/*
+ * Send an USB control report to the device.
+ * Must be called with razer_device.lock held.
+ * Returns 0 on success.
+ */
+int _razer_send(struct razer_device *razer_dev, struct razer_report *report)
+{
+	const uint size = sizeof(*report);
+	struct razer_report *buf = razer_dev->xfer_buf;
+	ktime_t start;
+	s64 pace_ns, duration_ns;
+	int retval;
+
+	memcpy(buf, report, size);
+
+	pace_ns = razer_pace(razer_dev);
+
+	start = ktime_get();
+	if (!razer_dev->latency.request_open) {
+		razer_dev->latency.request_start = start;
+		razer_dev->latency.request_open  = true;
+	}
+
+	retval = razer_dev->ops->send(razer_dev, buf);
+
+	razer_pace_done(razer_dev);
+
+	if (retval == 0) {
+		this_cpu_inc(razer_dev->stats->commands);
+		this_cpu_add(razer_dev->stats->bytes, size);
+	} else {
+		razer_dev->latency.request_open = false;
+	}
+
+	duration_ns = ktime_to_ns(ktime_sub(razer_dev->pacing.last_transfer,
+					    start));
+	razer_account_latency(razer_dev, RAZER_LATENCY_SEND, duration_ns);
+	trace_razer_send(razer_dev, report, pace_ns, duration_ns, retval);
+
+	return retval;
+}
+
+/*
+ * Get a response from the razer device.
+ * Must be called with razer_device.lock held.
+ * Returns 0 on success. On failure the report is zeroed.
+ */
+int _razer_receive(struct razer_device *razer_dev, struct razer_report *report)
+{
+	const uint size = sizeof(*report);
+	struct razer_report *buf = razer_dev->xfer_buf;
+	ktime_t start;
+	s64 pace_ns, duration_ns;
+	int retval;
+
+	memset(report, 0, size);
+
+	memset(buf, 0, size);
+
+	pace_ns = razer_pace(razer_dev);
+	start   = ktime_get();
+
+	retval = razer_dev->ops->receive(razer_dev, buf);
+
+	razer_pace_done(razer_dev);
+
+	if (retval == 0) {
+		memcpy(report, buf, size);
+
+		this_cpu_add(razer_dev->stats->bytes, size);
+		if (buf->status < RAZER_STATUS_COUNT)
+			this_cpu_inc(razer_dev->stats->status[buf->status]);
+	}
+
+	duration_ns = ktime_to_ns(ktime_sub(razer_dev->pacing.last_transfer,
+					    start));
+	razer_account_latency(razer_dev, RAZER_LATENCY_RECEIVE, duration_ns);
+	trace_razer_receive(razer_dev, buf, pace_ns, duration_ns, retval);
+
+	return retval;
+}
+
+int razer_receive(struct razer_device *razer_dev, struct razer_report *report)
+{
+	int retval;
+
+	razer_lock(razer_dev);
+	retval = _razer_receive(razer_dev, report);
+	mutex_unlock(&razer_dev->lock);
+
+	return retval;
+}
+EXPORT_SYMBOL_GPL(razer_receive);
+
+/*
+ * Account and trace the end of a request.
+ * Must be called with razer_device.lock held.
+ */
+static void razer_complete_request(struct razer_device *razer_dev,
+				   struct razer_report *request_r,
+				   uint polls, int retval)
+{
+	struct razer_latency *latency = &razer_dev->latency;
+	s64 duration_ns = 0;
+
+	if (latency->request_open) {
+		duration_ns = ktime_to_ns(ktime_sub(ktime_get(),
+						    latency->request_start));
+		razer_account_latency(razer_dev, RAZER_LATENCY_REQUEST,
+				      duration_ns);
+	}
+
+	trace_razer_complete(razer_dev, request_r, latency->lock_ns,
+			     duration_ns, polls, retval);
+
+	// Further requests under the same lock hold did not wait for it.
+	latency->request_open = false;
+	latency->lock_ns      = 0;
+}
+
+/*
+ * Convert the final status of a response.
+ * Returns 0 on SUCCESS.
+ */
+static int razer_check_status(struct razer_device *razer_dev,
+			      struct razer_report *response_r)
+{
+	switch (response_r->status) {
+	case RAZER_STATUS_SUCCESS:
+		return 0;
+
+	case RAZER_STATUS_FAILURE:
+	case RAZER_STATUS_TIMEOUT:
+	case RAZER_STATUS_NOT_SUPPORTED:
+		return -EINVAL;
+
+	default:
+		dev_err(&razer_dev->usb_dev->dev,
+			"razer_send_with_response: "
+			"unknown response status 0x%x\n",
+			response_r->status);
+		return -EINVAL;
+	}
+}
+
+/*
+ * Wait for the response to a report that has already been sent.
+ * Returns 0 on success.
+ */
+int _razer_wait_response(struct razer_device *razer_dev,
+			 struct razer_report *request_r,
+			 struct razer_report *response_r)
+{
+	struct razer_backoff backoff;
+	ktime_t deadline;
+	uint delay_us, polls = 0;
+	int retval;
+
+	// Poll with an exponentially growing delay while the device is busy.
+	razer_lookup_backoff(razer_dev, request_r->command_class, &backoff);
+	deadline = ktime_add_ms(ktime_get(), backoff.deadline_ms);
+	delay_us = backoff.initial_us;
+
+	while (true) {
+		retval = _razer_receive(razer_dev, response_r);
+		if (retval != 0)
+			break;
+
+		if (response_r->command_class != request_r->command_class ||
+		    response_r->command_id != request_r->command_id) {
+			dev_err(&razer_dev->usb_dev->dev,
+				"razer_send_with_response: "
+				"response commands do not match: "
+				"Request Class: %d "
+				"Request ID: %d "
+				"Response Class: %d "
+				"Response ID: %d\n",
+				request_r->command_class,
+				request_r->command_id,
+				response_r->command_class,
+				response_r->command_id);
+			retval = -EINVAL;
+			break;
+		}
+
+		if (response_r->status != RAZER_STATUS_BUSY)
+			break;
+
+		if (polls++ == 0)
+			razer_pacing_busy(razer_dev);
+
+		if (ktime_after(ktime_add_us(ktime_get(), delay_us), deadline)) {
+			dev_err(&razer_dev->usb_dev->dev,
+				"razer_send_with_response: "
+				"request failed: device is busy\n");
+			retval = -EBUSY;
+			break;
+		}
+
+		trace_razer_busy_retry(razer_dev, request_r, polls, delay_us);
+
+		this_cpu_inc(razer_dev->stats->retries);
+		razer_sleep_us(razer_dev, delay_us);
+		delay_us = min(delay_us * 2, backoff.max_us);
+	}
+
+	razer_count_polls(razer_dev, polls);
+
+	if (retval != 0)
+		goto exit_complete;
+
+	retval = razer_check_status(razer_dev, response_r);
+	if (retval == 0 && polls == 0)
+		razer_pacing_success(razer_dev);
+
+exit_complete:
+	razer_complete_request(razer_dev, request_r, polls, retval);
+
+	return retval;
+}
+
+/*
+ * Get the response policy of a command class.
+ * Must be called with razer_device.lock held.
+ */
+static enum razer_policy razer_lookup_policy(struct razer_device *razer_dev,
+					     unsigned char command_class)
+{
+	if (command_class < RAZER_POLICY_CLASSES)
+		return razer_dev->policy[command_class];
+
+	return RAZER_POLICY_CONFIRM;
+}
+
+/*
+ * Remember a sent request whose response is checked later.
+ * Must be called with razer_device.lock held.
+ */
+static void razer_defer(struct razer_device *razer_dev,
+			struct razer_report *request_r)
+{
+	razer_dev->outstanding     = *request_r;
+	razer_dev->has_outstanding = true;
+
+	// The request ends here for the latency accounting.
+	razer_dev->latency.request_open = false;
+}
+
+/*
+ * Check the response of the outstanding deferred request.
+ * A failure is kept as sticky error.
+ * Must be called with razer_device.lock held.
+ */
+static void _razer_settle(struct razer_device *razer_dev)
+{
+	struct razer_report response_report;
+	int retval;
+
+	if (!razer_dev->has_outstanding)
+		return;
+
+	razer_dev->has_outstanding = false;
+
+	retval = _razer_wait_response(razer_dev, &razer_dev->outstanding,
+				      &response_report);
+	if (retval != 0) {
+		razer_print_err_report(&razer_dev->outstanding,
+				       KBUILD_MODNAME,
+				       "deferred request failed");
+		if (razer_dev->sticky_error == 0)
+			razer_dev->sticky_error = retval;
+		razer_dev->deferred_failures++;
+	}
+}
+
+int razer_send(struct razer_device *razer_dev, struct razer_report *report)
+{
+	int retval;
+
+	razer_lock(razer_dev);
+	_razer_settle(razer_dev);
+	retval = _razer_send(razer_dev, report);
+	mutex_unlock(&razer_dev->lock);
+
+	return retval;
+}
+EXPORT_SYMBOL_GPL(razer_send);
+
+/*
+ * Send a report and wait for a response.
+ * Returns 0 on success.
+ */
+int _razer_send_with_response(struct razer_device *razer_dev,
+			      struct razer_report *request_r,
+			      struct razer_report *response_r)
+{
+	int retval;
+
+	retval = _razer_send(razer_dev, request_r);
+	if (retval != 0)
+		return retval;
+
+	return _razer_wait_response(razer_dev, request_r, response_r);
+}
+
+int razer_send_with_response(struct razer_device *razer_dev,
+			     struct razer_report *request_report,
+			     struct razer_report *response_report)
+{
+	int retval;
+
+	razer_lock(razer_dev);
+	_razer_settle(razer_dev);
+	retval = _razer_send_with_response(razer_dev,
+					   request_report, response_report);
+	mutex_unlock(&razer_dev->lock);
+
+	return retval;
+}
+EXPORT_SYMBOL_GPL(razer_send_with_response);
+
+/*
+ * Send a report and check the response status.
+ * With the deferred policy of the command class, the response is checked
+ * before the next request. A failure is then reported through
+ * razer_get_sticky_error instead.
+ * Returns 0 on success.
+ */
+int razer_send_check_response(struct razer_device *razer_dev,
+			      struct razer_report *request_report)
+{
+	struct razer_report response_report;
+	int retval;
+
+	razer_lock(razer_dev);
+
+	// The device keeps a single response. Check the previous deferred
+	// request before it is replaced.
+	_razer_settle(razer_dev);
+
+	if (razer_lookup_policy(razer_dev, request_report->command_class) ==
+	    RAZER_POLICY_DEFERRED) {
+		retval = _razer_send(razer_dev, request_report);
+		if (retval == 0)
+			razer_defer(razer_dev, request_report);
+	} else {
+		retval = _razer_send_with_response(razer_dev, request_report,
+						   &response_report);
+	}
+
+	mutex_unlock(&razer_dev->lock);
+
+	return retval;
+}
+EXPORT_SYMBOL_GPL(razer_send_check_response);
+
+/*
+ * Send a sequence of reports and confirm only the last one.
+ * The remaining_packets field counts down to zero over the sequence, so the
+ * device knows when the frame is complete. Only a single response is
+ * fetched per sequence instead of one per report.
+ * The reports must carry a valid checksum. It is updated incrementally.
+ * Returns 0 on success.
+ */
+int razer_send_frame(struct razer_device *razer_dev,
+		     struct razer_report *reports, uint count)
+{
+	uint sent;
+
+	return razer_send_frame_preemptible(razer_dev, reports, count,
+					    NULL, NULL, &sent);
+}
+EXPORT_SYMBOL_GPL(razer_send_frame);
+
+/*
+ * Same as razer_send_frame, but preempt is asked before every report but
+ * the last whether to end the sequence early. That report is then sent as
+ * the last one of the sequence, with remaining_packets 0, and confirmed,
+ * which releases the device for other requests. The device never sees an
+ * unfinished sequence interleaved with other requests. The remaining
+ * reports can be sent later as a sequence of their own.
+ * With the deferred policy of the command class, the last report is not
+ * confirmed. The response of the previous frame is checked instead.
+ * sent is set to the amount of reports sent.
+ * Returns 0 on success.
+ */
+int razer_send_frame_preemptible(struct razer_device *razer_dev,
+				 struct razer_report *reports, uint count,
+				 razer_preempt_fn preempt, void *context,
+				 uint *sent)
+{
+	struct razer_report response_report;
+	__be16 remaining;
+	int retval = 0;
+	uint i = 0;
+
+	*sent = 0;
+
+	if (count == 0)
+		return 0;
+
+	razer_lock(razer_dev);
+	_razer_settle(razer_dev);
+
+	while (i < count) {
+		// End the sequence with this report if preempted.
+		if (i + 1 < count && preempt && preempt(razer_dev, context))
+			count = i + 1;
+
+		remaining = cpu_to_be16(count - 1 - i);
+
+		reports[i].crc = razer_update_crc(reports[i].crc,
+						  &reports[i].remaining_packets,
+						  &remaining,
+						  sizeof(remaining));
+		reports[i].remaining_packets = remaining;
+
+		retval = _razer_send(razer_dev, &reports[i]);
+		if (retval != 0)
+			goto exit_unlock;
+
+		i++;
+	}
+
+	if (razer_lookup_policy(razer_dev, reports[i - 1].command_class) ==
+	    RAZER_POLICY_DEFERRED)
+		razer_defer(razer_dev, &reports[i - 1]);
+	else
+		retval = _razer_wait_response(razer_dev, &reports[i - 1],
+					      &response_report);
+	if (retval == 0)
+		*sent = i;
+
+exit_unlock:
+	mutex_unlock(&razer_dev->lock);
+
+	return retval;
+}
+EXPORT_SYMBOL_GPL(razer_send_frame_preemptible);
+
+/*
+ * Get the transaction id of the next tagged request.
+ * Must be called with razer_device.lock held.
+ */
+static unsigned char razer_next_tag(struct razer_device *razer_dev)
+{
+	unsigned char tag = razer_dev->next_tag;
+
+	if (tag >= RAZER_TAG_LAST)
+		razer_dev->next_tag = RAZER_TAG_FIRST;
+	else
+		razer_dev->next_tag = tag + 1;
+
+	return tag;
+}
+
+/*
+ * Find the request in flight a response belongs to.
+ * Must be called with razer_device.lock held.
+ * Returns NULL if no request matches.
+ */
+static struct razer_inflight *razer_match_inflight(
+				struct razer_device *razer_dev,
+				struct razer_report *response_r)
+{
+	struct razer_inflight *entry;
+	int i;
+
+	for (i = 0; i < RAZER_INFLIGHT_MAX; i++) {
+		entry = &razer_dev->inflight[i];
+
+		if (entry->used &&
+		    entry->request.transaction_id == response_r->transaction_id &&
+		    entry->request.command_class == response_r->command_class &&
+		    entry->request.command_id == response_r->command_id)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remove a request from the reorder table and store its result.
+ * Must be called with razer_device.lock held.
+ */
+static void razer_retire_inflight(struct razer_device *razer_dev,
+				  struct razer_inflight *entry, int *status,
+				  uint polls, int retval)
+{
+	status[entry->index] = retval;
+
+	razer_complete_request(razer_dev, &entry->request, polls, retval);
+
+	entry->used = false;
+	razer_dev->inflight_count--;
+}
+
+/*
+ * Tag a request with a transaction id, send it and add it to the
+ * reorder table.
+ * Must be called with razer_device.lock held and a free table entry.
+ * Returns 0 on success.
+ */
+static int razer_send_tagged(struct razer_device *razer_dev,
+			     struct razer_report *request_r, uint index)
+{
+	struct razer_inflight *entry = NULL;
+	int i, retval;
+
+	for (i = 0; i < RAZER_INFLIGHT_MAX; i++) {
+		if (!razer_dev->inflight[i].used) {
+			entry = &razer_dev->inflight[i];
+			break;
+		}
+	}
+
+	if (WARN_ON(!entry))
+		return -EBUSY;
+
+	request_r->transaction_id = razer_next_tag(razer_dev);
+	request_r->crc            = razer_calculate_crc(request_r);
+
+	retval = _razer_send(razer_dev, request_r);
+	if (retval != 0)
+		return retval;
 
-//##########################//
-//### Exported Functions ###//
-//##########################//
+	entry->request = *request_r;
+	entry->index   = index;
+	entry->used    = true;
+	razer_dev->inflight_count++;
+
+	return 0;
+}
 
 /*
- * Initialize a razer device struct.
+ * Fetch responses until one tagged request in flight is answered.
+ * A response is matched to its request by transaction id and command
+ * class/id, so the requests may be answered in any order. A BUSY
+ * response or one matching no request in flight is polled again with
+ * the backoff schedule of the oldest table entry.
+ * The result is stored in status at the index of the request.
+ * Must be called with razer_device.lock held.
+ * Returns 0 if a request was answered, or the error which ends the batch.
  */
-int razer_init_device(struct razer_device *razer_dev,
-		      struct usb_device *usb_dev)
+static int razer_reap_tagged(struct razer_device *razer_dev, int *status)
 {
-	razer_dev->data     = NULL;
-	razer_dev->usb_dev  = usb_dev;
-	mutex_init(&razer_dev->lock);
+	struct razer_report response_report;
+	struct razer_inflight *entry;
+	struct razer_backoff backoff;
+	ktime_t deadline;
+	uint delay_us, polls = 0;
+	int i, retval;
+
+	for (i = 0; i < RAZER_INFLIGHT_MAX; i++) {
+		if (razer_dev->inflight[i].used)
+			break;
+	}
+
+	if (WARN_ON(i == RAZER_INFLIGHT_MAX))
+		return -EINVAL;
+
+	razer_lookup_backoff(razer_dev,
+			     razer_dev->inflight[i].request.command_class,
+			     &backoff);
+	deadline = ktime_add_ms(ktime_get(), backoff.deadline_ms);
+	delay_us = backoff.initial_us;
+
+	while (true) {
+		retval = _razer_receive(razer_dev, &response_report);
+		if (retval != 0)
+			return retval;
+
+		entry = razer_match_inflight(razer_dev, &response_report);
+		if (entry && response_report.status != RAZER_STATUS_BUSY)
+			break;
+
+		if (polls++ == 0)
+			razer_pacing_busy(razer_dev);
+
+		if (ktime_after(ktime_add_us(ktime_get(), delay_us), deadline)) {
+			dev_err(&razer_dev->usb_dev->dev,
+				"razer_send_batch: "
+				"no response to the tagged requests\n");
+			return -ETIMEDOUT;
+		}
+
+		if (entry)
+			trace_razer_busy_retry(razer_dev, &entry->request,
+					       polls, delay_us);
+
+		this_cpu_inc(razer_dev->stats->retries);
+		razer_sleep_us(razer_dev, delay_us);
+		delay_us = min(delay_us * 2, backoff.max_us);
+	}
+
+	razer_count_polls(razer_dev, polls);
+
+	retval = razer_check_status(razer_dev, &response_report);
+	razer_retire_inflight(razer_dev, entry, status, polls, retval);
 
 	return 0;
 }
-EXPORT_SYMBOL_GPL(razer_init_device);
 
 /*
- * Get an initialised razer report
+ * Send a batch with up to inflight_depth tagged requests in flight.
+ * After a transfer error the requests in flight and the reports not sent
+ * yet fail with that error.
+ * Must be called with razer_device.lock held.
  */
-struct razer_report razer_new_report(void)
+static void _razer_send_batch_tagged(struct razer_device *razer_dev,
+				     struct razer_report *reports,
+				     int *status, uint count)
 {
-	struct razer_report new_report;
+	int i, error = 0;
+	uint next = 0;
 
-	memset(&new_report, 0, sizeof(new_report));
+	while (error == 0 && (next < count || razer_dev->inflight_count > 0)) {
+		if (next < count &&
+		    razer_dev->inflight_count < razer_dev->inflight_depth) {
+			error = razer_send_tagged(razer_dev, &reports[next],
+						  next);
+			status[next++] = error;
+		} else {
+			error = razer_reap_tagged(razer_dev, status);
+		}
+	}
 
-	new_report.status             = RAZER_STATUS_NEW_COMMAND;
-	new_report.transaction_id     = 0xFF;
-	new_report.remaining_packets  = 0x00;
-	new_report.protocol_type      = 0x00;
-	new_report.reserved           = 0x00;
-	new_report.command_class      = 0x00;
-	new_report.command_id         = 0x00;
-	new_report.data_size          = 0x00;
+	if (error == 0)
+		return;
 
-	return new_report;
+	for (i = 0; i < RAZER_INFLIGHT_MAX; i++) {
+		if (razer_dev->inflight[i].used)
+			razer_retire_inflight(razer_dev,
+					      &razer_dev->inflight[i],
+					      status, 0, error);
+	}
+
+	while (next < count)
+		status[next++] = error;
 }
-EXPORT_SYMBOL_GPL(razer_new_report);
 
 /*
- * Send an USB control report to the device.
- * Returns 0 on success.
+ * Send several reports back to back under a single lock hold.
+ * Each report is confirmed on its own and its result is stored in status.
+ * The gap before the next report is skipped once a report was confirmed
+ * with SUCCESS, since the device is idle again.
+ * With an inflight_depth above 1, the reports are tagged with their own
+ * transaction ids and up to inflight_depth of them are sent before their
+ * responses are fetched.
+ * The header fields and the CRC of the reports are filled in.
+ * Returns 0 on success or the first error.
  */
-int _razer_send(struct razer_device *razer_dev, struct razer_report *report)
+int razer_send_batch(struct razer_device *razer_dev,
+		     struct razer_report *reports, int *status, uint count)
 {
-	const uint size = sizeof(*report);
-	char *buf;
-	int len;
+	struct razer_report response_report;
+	int retval = 0;
+	uint i;
 
-	buf = kmemdup(report, size, GFP_KERNEL);
-	if (!buf)
-		return -ENOMEM;
+	razer_lock(razer_dev);
+	_razer_settle(razer_dev);
 
-	len =
-	usb_control_msg(razer_dev->usb_dev,
-			usb_sndctrlpipe(razer_dev->usb_dev, 0),
-			HID_REQ_SET_REPORT,                        // Request
-			USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_DIR_OUT,
-			0x300,                                     // Value
-			razer_dev->report_index,                   // Index
-			buf,                                       // Data
-			size,                                      // Length
-			USB_CTRL_SET_TIMEOUT);
+	for (i = 0; i < count; i++) {
+		reports[i].status            = RAZER_STATUS_NEW_COMMAND;
+		reports[i].remaining_packets = 0;
+		reports[i].protocol_type     = 0x00;
+		reports[i].reserved          = 0x00;
+		reports[i].crc               = razer_calculate_crc(&reports[i]);
+	}
+
+	if (razer_dev->inflight_depth > 1) {
+		_razer_send_batch_tagged(razer_dev, reports, status, count);
+	} else {
+		for (i = 0; i < count; i++) {
+			status[i] = _razer_send_with_response(razer_dev,
+							      &reports[i],
+							      &response_report);
+			if (status[i] == 0)
+				razer_pace_skip(razer_dev);
+		}
+	}
 
-	usleep_range(600, 800);
+	mutex_unlock(&razer_dev->lock);
 
-	kfree(buf);
+	for (i = 0; i < count && retval == 0; i++)
+		retval = status[i];
 
-	return ((len < 0) ? len : ((len != size) ? -EIO : 0));
+	return retval;
 }
+EXPORT_SYMBOL_GPL(razer_send_batch);
 
-int razer_send(struct razer_device *razer_dev, struct razer_report *report)
+/*
+ * Returns the learned gap between two transfers in microseconds.
+ */
+uint razer_get_pacing_gap(struct razer_device *razer_dev)
 {
-	int retval;
+	uint gap_us;
 
 	mutex_lock(&razer_dev->lock);
-	retval = _razer_send(razer_dev, report);
+	gap_us = razer_dev->pacing.gap_us;
+	mutex_unlock(&razer_dev->lock);
+
+	return gap_us;
+}
+EXPORT_SYMBOL_GPL(razer_get_pacing_gap);
+
+/*
+ * Restart learning from the given gap in microseconds.
+ * The value must lie within the lower bound and the current upper bound.
+ */
+int razer_set_pacing_gap(struct razer_device *razer_dev, uint gap_us)
+{
+	int retval = 0;
+
+	mutex_lock(&razer_dev->lock);
+	if (gap_us < RAZER_PACING_MIN_US ||
+	    gap_us > razer_dev->pacing.max_us) {
+		retval = -EINVAL;
+	} else {
+		razer_dev->pacing.gap_us = gap_us;
+		razer_dev->pacing.streak = 0;
+	}
 	mutex_unlock(&razer_dev->lock);
 
 	return retval;
 }
-EXPORT_SYMBOL_GPL(razer_send);
+EXPORT_SYMBOL_GPL(razer_set_pacing_gap);
 
 /*
- * Get a response from the razer device.
+ * Returns the upper bound of the learned gap in microseconds.
+ */
+uint razer_get_pacing_max(struct razer_device *razer_dev)
+{
+	uint max_us;
+
+	mutex_lock(&razer_dev->lock);
+	max_us = razer_dev->pacing.max_us;
+	mutex_unlock(&razer_dev->lock);
+
+	return max_us;
+}
+EXPORT_SYMBOL_GPL(razer_get_pacing_max);
+
+/*
+ * Set the upper bound of the learned gap in microseconds.
+ * The learned gap is clamped to the new bound.
+ */
+int razer_set_pacing_max(struct razer_device *razer_dev, uint max_us)
+{
+	if (max_us < RAZER_PACING_MIN_US || max_us > RAZER_PACING_LIMIT_US)
+		return -EINVAL;
+
+	mutex_lock(&razer_dev->lock);
+	razer_dev->pacing.max_us = max_us;
+	razer_dev->pacing.gap_us = min(razer_dev->pacing.gap_us, max_us);
+	mutex_unlock(&razer_dev->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(razer_set_pacing_max);
+
+/*
+ * Get the busy schedule of a command class.
  * Returns 0 on success.
  */
-int _razer_receive(struct razer_device *razer_dev, struct razer_report *report)
+int razer_get_backoff(struct razer_device *razer_dev,
+		      unsigned char command_class,
+		      struct razer_backoff *backoff)
 {
-	const uint size = sizeof(*report);
-	int len;
+	mutex_lock(&razer_dev->lock);
+	razer_lookup_backoff(razer_dev, command_class, backoff);
+	mutex_unlock(&razer_dev->lock);
 
-	memset(report, 0, size);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(razer_get_backoff);
 
-	len =
-	usb_control_msg(razer_dev->usb_dev,
-			usb_rcvctrlpipe(razer_dev->usb_dev, 0),
-			HID_REQ_GET_REPORT,                          // Request
-			USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_DIR_IN,
-			0x300,                                       // Value
-			razer_dev->report_index,                     // Index
-			report,                                      // Data
-			size,
-			USB_CTRL_SET_TIMEOUT);
+/*
+ * Set the busy schedule of a command class.
+ * Only the classes 0x00-0x0F are configurable.
+ * Returns 0 on success.
+ */
+int razer_set_backoff(struct razer_device *razer_dev,
+		      unsigned char command_class,
+		      const struct razer_backoff *backoff)
+{
+	if (command_class >= RAZER_BACKOFF_CLASSES)
+		return -EINVAL;
 
-	usleep_range(600, 800);
+	if (backoff->initial_us == 0 ||
+	    backoff->initial_us > backoff->max_us ||
+	    backoff->max_us > RAZER_BACKOFF_LIMIT_US ||
+	    backoff->deadline_ms == 0 ||
+	    backoff->deadline_ms > RAZER_BACKOFF_LIMIT_MS)
+		return -EINVAL;
 
-	return ((len < 0) ? len : ((len != size) ? -EIO : 0));
+	mutex_lock(&razer_dev->lock);
+	razer_dev->backoff[command_class] = *backoff;
+	mutex_unlock(&razer_dev->lock);
+
+	return 0;
 }
+EXPORT_SYMBOL_GPL(razer_set_backoff);
 
-int razer_receive(struct razer_device *razer_dev, struct razer_report *report)
+/*
+ * Get the response policy of a command class.
+ */
+enum razer_policy razer_get_policy(struct razer_device *razer_dev,
+				   unsigned char command_class)
 {
-	int retval;
+	enum razer_policy policy;
 
 	mutex_lock(&razer_dev->lock);
-	retval = _razer_receive(razer_dev, report);
+	policy = razer_lookup_policy(razer_dev, command_class);
 	mutex_unlock(&razer_dev->lock);
 
-	return retval;
+	return policy;
 }
-EXPORT_SYMBOL_GPL(razer_receive);
+EXPORT_SYMBOL_GPL(razer_get_policy);
 
 /*
- * Send a report and wait for a response.
+ * Set the response policy of a command class.
+ * Only the classes 0x00-0x0F are configurable.
  * Returns 0 on success.
  */
-int _razer_send_with_response(struct razer_device *razer_dev,
-			      struct razer_report *request_r,
-			      struct razer_report *response_r)
+int razer_set_policy(struct razer_device *razer_dev,
+		     unsigned char command_class, enum razer_policy policy)
 {
-	int retval, r;
+	if (command_class >= RAZER_POLICY_CLASSES)
+		return -EINVAL;
 
-	retval = _razer_send(razer_dev, request_r);
-	if (retval != 0)
-		return retval;
+	if (policy != RAZER_POLICY_CONFIRM && policy != RAZER_POLICY_DEFERRED)
+		return -EINVAL;
 
-	// Retry 40 times when busy -> 125 milliseconds -> max 5 seconds wait
-	for (r = 0; r < 40; r++) {
-		retval = _razer_receive(razer_dev, response_r);
-		if (retval != 0)
-			return retval;
+	mutex_lock(&razer_dev->lock);
+	razer_dev->policy[command_class] = policy;
+	mutex_unlock(&razer_dev->lock);
 
-		if (response_r->command_class != request_r->command_class ||
-		    response_r->command_id != request_r->command_id) {
-			dev_err(&razer_dev->usb_dev->dev,
-				"razer_send_with_response: "
-				"response commands do not match: "
-				"Request Class: %d "
-				"Request ID: %d "
-				"Response Class: %d "
-				"Response ID: %d\n",
-				request_r->command_class,
-				request_r->command_id,
-				response_r->command_class,
-				response_r->command_id);
-			return -EINVAL;
-		}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(razer_set_policy);
 
-		switch (response_r->status) {
-		case RAZER_STATUS_SUCCESS:
-			return 0;
+/*
+ * Check the response of the outstanding deferred request now.
+ * Returns the amount of failed deferred requests since init, so callers
+ * can tell whether one failed since they last looked.
+ */
+uint razer_settle(struct razer_device *razer_dev)
+{
+	uint failures;
 
-		case RAZER_STATUS_BUSY:
-			msleep(125);
-			continue;
+	razer_lock(razer_dev);
+	_razer_settle(razer_dev);
+	failures = razer_dev->deferred_failures;
+	mutex_unlock(&razer_dev->lock);
 
-		case RAZER_STATUS_FAILURE:
-		case RAZER_STATUS_TIMEOUT:
-		case RAZER_STATUS_NOT_SUPPORTED:
-			return -EINVAL;
+	return failures;
+}
+EXPORT_SYMBOL_GPL(razer_settle);
 
-		default:
-			dev_err(&razer_dev->usb_dev->dev,
-				"razer_send_with_response: "
-				"unknown response status 0x%x\n",
-				response_r->status);
-			return -EINVAL;
-		}
-	}
+/*
+ * Returns the first failure of a deferred request or 0.
+ * The error is cleared if clear is set.
+ */
+int razer_get_sticky_error(struct razer_device *razer_dev, bool clear)
+{
+	int error;
 
-	dev_err(&razer_dev->usb_dev->dev, "razer_send_with_response: "
-		"request failed: device is busy\n");
+	mutex_lock(&razer_dev->lock);
+	error = razer_dev->sticky_error;
+	if (clear)
+		razer_dev->sticky_error = 0;
+	mutex_unlock(&razer_dev->lock);
 
-	return -EBUSY;
+	return error;
 }
+EXPORT_SYMBOL_GPL(razer_get_sticky_error);
 
-int razer_send_with_response(struct razer_device *razer_dev,
-			     struct razer_report *request_report,
-			     struct razer_report *response_report)
+/*
+ * Get the number of batch requests sent before their responses are fetched.
+ */
+uint razer_get_inflight_depth(struct razer_device *razer_dev)
 {
-	int retval;
+	uint depth;
 
 	mutex_lock(&razer_dev->lock);
-	retval = _razer_send_with_response(razer_dev,
-					   request_report, response_report);
+	depth = razer_dev->inflight_depth;
 	mutex_unlock(&razer_dev->lock);
 
-	return retval;
+	return depth;
 }
-EXPORT_SYMBOL_GPL(razer_send_with_response);
+EXPORT_SYMBOL_GPL(razer_get_inflight_depth);
 
 /*
- * Send a report, wait for a response and check the response status.
+ * Set the number of batch requests sent before their responses are fetched.
+ * A depth above 1 requires a firmware which queues tagged responses.
  * Returns 0 on success.
  */
-int razer_send_check_response(struct razer_device *razer_dev,
-			      struct razer_report *request_report)
+int razer_set_inflight_depth(struct razer_device *razer_dev, uint depth)
 {
-	struct razer_report response_report;
+	if (depth < 1 || depth > RAZER_INFLIGHT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&razer_dev->lock);
+	razer_dev->inflight_depth = depth;
+	mutex_unlock(&razer_dev->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(razer_set_inflight_depth);
+
+/*
+ * Get the transport counters summed over all CPUs.
+ */
+void razer_get_stats(struct razer_device *razer_dev,
+		     struct razer_stats *stats)
+{
+	struct razer_stats *cpu_stats;
+	int cpu, i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for_each_possible_cpu(cpu) {
+		cpu_stats = per_cpu_ptr(razer_dev->stats, cpu);
 
-	return razer_send_with_response(razer_dev,
-					request_report, &response_report);
+		stats->commands     += cpu_stats->commands;
+		stats->bytes        += cpu_stats->bytes;
+		stats->retries      += cpu_stats->retries;
+		stats->lock_wait_ns += cpu_stats->lock_wait_ns;
+		stats->sleep_ns     += cpu_stats->sleep_ns;
+
+		for (i = 0; i < RAZER_STATUS_COUNT; i++)
+			stats->status[i] += cpu_stats->status[i];
+	}
 }
-EXPORT_SYMBOL_GPL(razer_send_check_response);
+EXPORT_SYMBOL_GPL(razer_get_stats);
+
+/*
+ * Get the histogram of BUSY polls per request.
+ */
+void razer_get_busy_polls(struct razer_device *razer_dev,
+			  u64 polls[RAZER_POLL_BUCKETS])
+{
+	mutex_lock(&razer_dev->lock);
+	memcpy(polls, razer_dev->busy_polls, sizeof(razer_dev->busy_polls));
+	mutex_unlock(&razer_dev->lock);
+}
+EXPORT_SYMBOL_GPL(razer_get_busy_polls);
 
 /*
  * Calculate the checksum for the usb message
@@ -255,22 +1439,30 @@ EXPORT_SYMBOL_GPL(razer_send_check_response);
  * Checksum byte is stored in the 2nd last byte in the messages payload.
  * The checksum is generated by XORing all the bytes in the report starting
  * at byte number 2 (0 based) and ending at byte 88.
+ *
+ * The bytes 0-87 are XORed eight at a time and folded to a single byte.
+ * The bytes 0 and 1 are XORed out again afterwards.
  */
 unsigned char razer_calculate_crc(struct razer_report *report)
 {
-	// Second to last byte of report is a simple checksum.
-	// Just xor all bytes up with overflow and you are done.
-	unsigned char crc = 0;
 	unsigned char *_report = (unsigned char *)report;
-	unsigned int i;
-
-	for (i = 2; i < 88; i++)
-		crc ^= _report[i];
 
-	return crc;
+	return razer_xor_fold(_report, RAZER_CRC_END) ^
+	       _report[0] ^ _report[1];
 }
 EXPORT_SYMBOL_GPL(razer_calculate_crc);
 
+/*
+ * Update a checksum after len bytes of a report changed from old to new.
+ * The changed bytes must lie within the bytes 2-87, e.g. in arguments.
+ */
+unsigned char razer_update_crc(unsigned char crc, const void *old,
+			       const void *new, uint len)
+{
+	return crc ^ razer_xor_fold(old, len) ^ razer_xor_fold(new, len);
+}
+EXPORT_SYMBOL_GPL(razer_update_crc);
+
 /*
  * Detailed error print
  */
@@ -294,3 +1486,39 @@ void razer_print_err_report(struct razer_report *report,
 	       report->arguments[8], report->arguments[9]);
 }
 EXPORT_SYMBOL_GPL(razer_print_err_report);
+
+//##########################//
+//### Module Init / Exit ###//
+//##########################//
+
+static int __init razer_common_init(void)
+{
+	int retval;
+
+	retval = razer_crc_selftest();
+	if (retval != 0)
+		return retval;
+
+	// Failures are not fatal. debugfs ignores invalid parents.
+	razer_debugfs_root = debugfs_create_dir("razer", NULL);
+
+	return 0;
+}
+
+static void __exit razer_common_exit(void)
+{
+	debugfs_remove_recursive(razer_debugfs_root);
+}
+
+module_init(razer_common_init);
+module_exit(razer_common_exit);
+
+//###################//
+//### KUnit Tests ###//
+//###################//
+
+// The software device emulator and the suite of the report transport.
+#if IS_ENABLED(CONFIG_HID_RAZER_KUNIT_TEST)
+#include "hid-razer-emu.c"
+#include "hid-razer-common-test.c"
+#endif
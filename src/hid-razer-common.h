@@ -19,6 +19,53 @@
 
 #include <linux/usb.h>
 #include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+
+//#################//
+//### Constants ###//
+//#################//
+
+// Gap between two transfers in microseconds: initial value, lower bound
+// and default upper bound of the learned value.
+#define RAZER_PACING_DEFAULT_US  600
+#define RAZER_PACING_MIN_US      50
+#define RAZER_PACING_MAX_US      2000
+#define RAZER_PACING_LIMIT_US    100000
+
+// Consecutive SUCCESS responses required before the gap is shrunk.
+#define RAZER_PACING_STREAK      16
+
+// Default schedule for polling a BUSY device: first delay and upper bound
+// of the exponentially growing delay in microseconds, and the deadline of
+// a request in milliseconds.
+#define RAZER_BACKOFF_INITIAL_US   100
+#define RAZER_BACKOFF_MAX_US       125000
+#define RAZER_BACKOFF_DEADLINE_MS  5000
+#define RAZER_BACKOFF_LIMIT_US     1000000
+#define RAZER_BACKOFF_LIMIT_MS     60000
+
+// Command classes 0x00-0x0F have a configurable schedule.
+// All other classes use the default schedule.
+#define RAZER_BACKOFF_CLASSES      16
+
+// Command classes 0x00-0x0F have a configurable response policy.
+// All other classes always wait for the response.
+#define RAZER_POLICY_CLASSES       16
+
+// Maximum requests in flight at once. Tagged requests use the
+// transaction ids 0x01-0x7F, 0x80 and 0xFF are left to untagged reports.
+#define RAZER_INFLIGHT_MAX         8
+#define RAZER_TAG_FIRST            0x01
+#define RAZER_TAG_LAST             0x7F
+
+// Histogram buckets of BUSY polls per request:
+// 0, 1, 2, 3-4, 5-8, 9-16, 17-32, 33+
+#define RAZER_POLL_BUCKETS         8
+
+// Log2 latency histogram buckets in microseconds:
+// 0, 1, 2-3, 4-7, ..., 16384+
+#define RAZER_LATENCY_BUCKETS      16
 
 //#############//
 //### Types ###//
@@ -33,11 +80,72 @@ enum razer_status {
 	RAZER_STATUS_NOT_SUPPORTED = 0x05
 };
 
-struct razer_device {
-	struct usb_device *usb_dev;
-	struct mutex      lock;          // Synchronize usb access.
-	uint              report_index;  // The report index to use.
-	void              *data;         // Optional custom data.
+#define RAZER_STATUS_COUNT 6
+
+// Response policy of set requests per command class.
+enum razer_policy {
+	RAZER_POLICY_CONFIRM,   // Wait for the response of every request.
+	RAZER_POLICY_DEFERRED,  // Check it before the next other request.
+};
+
+// Transport counters. Kept per CPU and summed up by razer_get_stats.
+struct razer_stats {
+	u64 commands;                    // Reports sent.
+	u64 bytes;                       // Bytes sent and received.
+	u64 status[RAZER_STATUS_COUNT];  // Responses per razer_status.
+	u64 retries;                     // Polls repeated after BUSY.
+	u64 lock_wait_ns;                // Waiting for razer_device.lock.
+	u64 sleep_ns;                    // Sleeping for pacing and backoff.
+};
+
+// Latency histograms of the report transport.
+enum razer_latency_kind {
+	RAZER_LATENCY_LOCK,     // Waiting for razer_device.lock.
+	RAZER_LATENCY_PACE,     // Waiting for the pacing gap.
+	RAZER_LATENCY_SEND,     // SET_REPORT transfer.
+	RAZER_LATENCY_RECEIVE,  // GET_REPORT transfer.
+	RAZER_LATENCY_REQUEST,  // First send to final response.
+	RAZER_LATENCY_KINDS
+};
+
+struct razer_device;
+struct razer_report;
+struct dentry;
+
+// Called before every report of a frame but the last with
+// razer_device.lock held. Returns true to end the frame with that report.
+typedef bool (*razer_preempt_fn)(struct razer_device *razer_dev,
+				 void *context);
+
+// Transport of synchronous reports. Both functions transfer a single
+// report through the DMA-safe buffer buf and return 0 or a negative
+// error code. They are called with razer_device.lock held.
+// razer_init_device selects the USB control transport. It may be replaced
+// before the first transfer, e.g. by the software emulator of
+// hid-razer-emu.c.
+struct razer_transport_ops {
+	int (*send)(struct razer_device *razer_dev, struct razer_report *buf);
+	int (*receive)(struct razer_device *razer_dev,
+		       struct razer_report *buf);
+};
+
+// Adaptive inter-transfer gap. Protected by razer_device.lock.
+// gap_us:        Learned minimum gap between two transfers.
+// max_us:        Upper bound for gap_us.
+// streak:        Consecutive SUCCESS responses since the last change.
+// last_transfer: Time the last transfer finished.
+struct razer_pacing {
+	uint    gap_us;
+	uint    max_us;
+	uint    streak;
+	ktime_t last_transfer;
+};
+
+// Schedule for polling a BUSY device.
+struct razer_backoff {
+	uint initial_us;   // Delay before the first poll.
+	uint max_us;       // The delay doubles up to this bound.
+	uint deadline_ms;  // Give up after this time.
 };
 
 struct razer_rgb {
@@ -58,7 +166,7 @@ struct razer_rgb {
 struct razer_report {
 	unsigned char   status;
 	unsigned char   transaction_id;
-	unsigned short  remaining_packets;
+	__be16          remaining_packets;
 	unsigned char   protocol_type;
 	unsigned char   data_size;
 	unsigned char   command_class;
@@ -68,6 +176,67 @@ struct razer_report {
 	unsigned char   reserved;
 };
 
+// Entry of the reorder table of tagged requests in flight.
+// request: The request as sent. Its transaction id is the tag.
+// index:   Position of the request in the caller's batch.
+struct razer_inflight {
+	struct razer_report request;
+	uint                index;
+	bool                used;
+};
+
+// Latency accounting. Protected by razer_device.lock.
+// request_start: Time the first report of the open request was sent.
+// request_open:  A request was sent but its response not fetched yet.
+// lock_ns:       Time the current lock holder waited for the lock.
+// hist:          Log2 histograms per razer_latency_kind.
+struct razer_latency {
+	ktime_t request_start;
+	bool    request_open;
+	s64     lock_ns;
+	u64     hist[RAZER_LATENCY_KINDS][RAZER_LATENCY_BUCKETS];
+};
+
+struct razer_device {
+	struct usb_device *usb_dev;
+	struct mutex      lock;          // Synchronize usb access.
+	uint              report_index;  // The report index to use.
+	void              *data;         // Optional custom data.
+
+	const struct razer_transport_ops *ops;  // Synchronous transport.
+
+	struct razer_pacing pacing;      // Gap between two transfers.
+	struct razer_latency latency;    // Transport latency histograms.
+	struct razer_stats __percpu *stats;  // Transport counters.
+	struct dentry       *debugfs;    // Per-device debugfs directory.
+
+	// DMA-safe buffer for synchronous transfers. Protected by lock.
+	struct razer_report  *xfer_buf;
+
+	// Protected by lock.
+	struct razer_backoff backoff[RAZER_BACKOFF_CLASSES];
+	u64                  busy_polls[RAZER_POLL_BUCKETS];
+
+	// Deferred set requests. Protected by lock.
+	// outstanding:       Last deferred request. Its response is not
+	//                    checked yet.
+	// sticky_error:      First failure of a deferred request until cleared.
+	// deferred_failures: Failed deferred requests since init.
+	enum razer_policy    policy[RAZER_POLICY_CLASSES];
+	struct razer_report  outstanding;
+	bool                 has_outstanding;
+	int                  sticky_error;
+	uint                 deferred_failures;
+
+	// Tagged requests in flight. Protected by lock.
+	// inflight_depth: Requests sent before the first response is fetched.
+	//                 1 keeps a single untagged request in flight.
+	struct razer_inflight inflight[RAZER_INFLIGHT_MAX];
+	uint                  inflight_depth;
+	uint                  inflight_count;
+	unsigned char         next_tag;
+};
+
 //#################//
 //### Functions ###//
 //#################//
@@ -75,6 +244,9 @@ struct razer_report {
 int razer_init_device(struct razer_device *razer_dev,
 		      struct usb_device *usb_dev);
 
+void razer_deinit_device(struct razer_device *razer_dev);
+void razer_create_debugfs(struct razer_device *razer_dev, const char *name);
+
 struct razer_report razer_new_report(void);
 
 int razer_send(struct razer_device *razer_dev, struct razer_report *report);
@@ -88,7 +260,50 @@ int razer_send_with_response(struct razer_device *razer_dev,
 int razer_send_check_response(struct razer_device *razer_dev,
 			      struct razer_report *request_report);
 
+int razer_send_frame(struct razer_device *razer_dev,
+		     struct razer_report *reports, uint count);
+int razer_send_frame_preemptible(struct razer_device *razer_dev,
+				 struct razer_report *reports, uint count,
+				 razer_preempt_fn preempt, void *context,
+				 uint *sent);
+
+int razer_send_batch(struct razer_device *razer_dev,
+		     struct razer_report *reports, int *status, uint count);
+
+uint razer_get_pacing_gap(struct razer_device *razer_dev);
+
+int razer_set_pacing_gap(struct razer_device *razer_dev, uint gap_us);
+
+uint razer_get_pacing_max(struct razer_device *razer_dev);
+
+int razer_set_pacing_max(struct razer_device *razer_dev, uint max_us);
+
+int razer_get_backoff(struct razer_device *razer_dev,
+		      unsigned char command_class,
+		      struct razer_backoff *backoff);
+
+int razer_set_backoff(struct razer_device *razer_dev,
+		      unsigned char command_class,
+		      const struct razer_backoff *backoff);
+
+enum razer_policy razer_get_policy(struct razer_device *razer_dev,
+				   unsigned char command_class);
+int razer_set_policy(struct razer_device *razer_dev,
+		     unsigned char command_class, enum razer_policy policy);
+uint razer_settle(struct razer_device *razer_dev);
+int razer_get_sticky_error(struct razer_device *razer_dev, bool clear);
+
+uint razer_get_inflight_depth(struct razer_device *razer_dev);
+int razer_set_inflight_depth(struct razer_device *razer_dev, uint depth);
+
+void razer_get_stats(struct razer_device *razer_dev,
+		     struct razer_stats *stats);
+void razer_get_busy_polls(struct razer_device *razer_dev,
+			  u64 polls[RAZER_POLL_BUCKETS]);
+
 unsigned char razer_calculate_crc(struct razer_report *report);
+unsigned char razer_update_crc(unsigned char crc, const void *old,
+			       const void *new, uint len);
 
 void razer_print_err_report(struct razer_report *report,
 			    char *driver_name, char *message);
@@ -0,0 +1,241 @@
+/*
+ * Razer Kernel Drivers
+ * Copyright (c) 2016 Roland Singer <roland.singer@desertbit.com>
+ * Based on Tim Theede <pez2001@voyagerproject.de> razer_chroma_drivers project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Software device emulator. Built into hid-razer-common with
+ * CONFIG_HID_RAZER_KUNIT_TEST and used by the KUnit suites.
+ */
+
+#include <linux/delay.h>
+#include <linux/string.h>
+
+#include "hid-razer-emu.h"
+
+//########################//
+//### Helper functions ###//
+//########################//
+
+/*
+ * Wait for the duration of an emulated transfer.
+ */
+static void razer_emu_transfer(struct razer_emu *emu)
+{
+	if (emu->delay_us)
+		fsleep(emu->delay_us);
+}
+
+/*
+ * Take the final status of the next request from the script.
+ */
+static enum razer_status razer_emu_next_status(struct razer_emu *emu)
+{
+	enum razer_status status;
+
+	if (emu->script_len == 0)
+		return emu->status;
+
+	status = emu->script[0];
+	emu->script_len--;
+	memmove(&emu->script[0], &emu->script[1], emu->script_len);
+
+	return status;
+}
+
+/*
+ * Apply a row report to the matrix.
+ * Returns false if the device rejects its arguments.
+ */
+static bool razer_emu_apply_row(struct razer_emu *emu,
+				struct razer_report *report)
+{
+	uint row   = report->arguments[1];
+	uint start = report->arguments[2];
+	uint end   = report->arguments[3];
+	uint len;
+
+	if (row >= RAZER_EMU_ROWS || start > end || end >= RAZER_EMU_COLUMNS)
+		return false;
+
+	len = (end - start + 1) * 3;
+	if (len + 4 > sizeof(report->arguments) || report->data_size != len + 4)
+		return false;
+
+	memcpy(&emu->matrix[row][start * 3], &report->arguments[4], len);
+	emu->rows++;
+
+	return true;
+}
+
+/*
+ * Receive a report sent with SET_REPORT.
+ */
+static int razer_emu_send(struct razer_device *razer_dev,
+			  struct razer_report *buf)
+{
+	struct razer_emu *emu = container_of(razer_dev, struct razer_emu,
+					     razer_dev);
+	struct razer_emu_pending *pending;
+	enum razer_status status;
+	bool row, tagged;
+
+	razer_emu_transfer(emu);
+
+	if (emu->send_error)
+		return emu->send_error;
+
+	emu->sends++;
+	emu->last = *buf;
+
+	row    = buf->command_class == 0x03 && buf->command_id == 0x0B;
+	tagged = buf->transaction_id >= RAZER_TAG_FIRST &&
+		 buf->transaction_id <= RAZER_TAG_LAST;
+	status = razer_emu_next_status(emu);
+
+	// A row sequence ends with the report without remaining packets.
+	if (row) {
+		emu->seq_open = be16_to_cpu(buf->remaining_packets) != 0;
+		if (!emu->seq_open)
+			emu->sequences++;
+	} else if (emu->seq_open) {
+		emu->interleaved++;
+	}
+
+	if (buf->crc != razer_calculate_crc(buf)) {
+		emu->bad_crc++;
+		status = RAZER_STATUS_FAILURE;
+	}
+
+	if (status == RAZER_STATUS_SUCCESS) {
+		if (row && !razer_emu_apply_row(emu, buf)) {
+			emu->rejected++;
+			status = RAZER_STATUS_FAILURE;
+		} else if (buf->command_class == 0x03 &&
+			   buf->command_id == 0x0A) {
+			emu->effect = buf->arguments[0];
+		}
+	}
+
+	// An untagged request replaces the requests waiting for a response.
+	// The oldest tagged one is dropped if there is no room left.
+	if (!tagged) {
+		emu->pending_count = 0;
+	} else if (emu->pending_count == RAZER_INFLIGHT_MAX) {
+		emu->pending_count--;
+		memmove(&emu->pending[0], &emu->pending[1],
+			emu->pending_count * sizeof(*pending));
+	}
+
+	pending = &emu->pending[emu->pending_count++];
+	pending->request = *buf;
+	pending->status  = status;
+	pending->busy    = emu->busy;
+
+	return 0;
+}
+
+/*
+ * Answer a GET_REPORT request.
+ * Without a request waiting, the last response is sent again.
+ */
+static int razer_emu_receive(struct razer_device *razer_dev,
+			     struct razer_report *buf)
+{
+	struct razer_emu *emu = container_of(razer_dev, struct razer_emu,
+					     razer_dev);
+	struct razer_emu_pending *pending = &emu->pending[0];
+
+	razer_emu_transfer(emu);
+
+	if (emu->receive_error)
+		return emu->receive_error;
+
+	emu->receives++;
+
+	if (emu->pending_count > 0) {
+		emu->response = pending->request;
+
+		if (pending->busy > 0) {
+			pending->busy--;
+			emu->response.status = RAZER_STATUS_BUSY;
+		} else {
+			emu->response.status = pending->status;
+			emu->pending_count--;
+			memmove(&emu->pending[0], &emu->pending[1],
+				emu->pending_count * sizeof(*pending));
+		}
+
+		emu->response.crc = razer_calculate_crc(&emu->response);
+	}
+
+	*buf = emu->response;
+
+	return 0;
+}
+
+static const struct razer_transport_ops razer_emu_ops = {
+	.send    = razer_emu_send,
+	.receive = razer_emu_receive,
+};
+
+//##########################//
+//### Exported Functions ###//
+//##########################//
+
+/*
+ * Initialize an emulator and its razer device. emu must be zeroed.
+ * All requests succeed at once until the behaviour is changed.
+ * Call razer_emu_deinit to release the allocated resources.
+ */
+int razer_emu_init(struct razer_emu *emu)
+{
+	int retval;
+
+	emu->usb_dev.dev.init_name = "razer-emu";
+	emu->usb_dev.bus           = &emu->usb_bus;
+
+	retval = razer_init_device(&emu->razer_dev, &emu->usb_dev);
+	if (retval != 0)
+		return retval;
+
+	emu->razer_dev.ops = &razer_emu_ops;
+	razer_emu_reset(emu);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(razer_emu_init);
+
+/*
+ * Release the resources of an emulator.
+ */
+void razer_emu_deinit(struct razer_emu *emu)
+{
+	razer_deinit_device(&emu->razer_dev);
+}
+EXPORT_SYMBOL_GPL(razer_emu_deinit);
+
+/*
+ * Restore the default behaviour, the device state and the counters.
+ * The settings of the razer device are kept.
+ * Must not be called while transfers run.
+ */
+void razer_emu_reset(struct razer_emu *emu)
+{
+	const size_t start = offsetof(struct razer_emu, status);
+
+	memset((unsigned char *)emu + start, 0, sizeof(*emu) - start);
+	emu->status = RAZER_STATUS_SUCCESS;
+}
+EXPORT_SYMBOL_GPL(razer_emu_reset);
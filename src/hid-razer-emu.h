@@ -0,0 +1,102 @@
+/*
+ * Razer Kernel Drivers
+ * Copyright (c) 2016 Roland Singer <roland.singer@desertbit.com>
+ * Based on Tim Theede <pez2001@voyagerproject.de> razer_chroma_drivers project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __HID_RAZER_EMU_H
+#define __HID_RAZER_EMU_H
+
+#include <linux/usb.h>
+#include <linux/types.h>
+
+#include "hid-razer-common.h"
+
+//#################//
+//### Constants ###//
+//#################//
+
+// Size of the emulated LED matrix.
+#define RAZER_EMU_ROWS        8
+#define RAZER_EMU_COLUMNS     32
+
+// Scripted final statuses of the next requests.
+#define RAZER_EMU_SCRIPT_MAX  16
+
+//#############//
+//### Types ###//
+//#############//
+
+// Request of the emulated device waiting for its response.
+// status: Final status, sent once busy BUSY responses were sent.
+struct razer_emu_pending {
+	struct razer_report request;
+	enum razer_status   status;
+	uint                busy;
+};
+
+// Software emulation of a keyboard behind the transport operations.
+// It answers the reports of razer_dev without USB, so the protocol code
+// can be tested and benchmarked on a machine without hardware.
+// An untagged request replaces the requests waiting for a response, a
+// tagged one is queued behind them. GET_REPORT answers the oldest one.
+// All fields are protected by razer_dev.lock once transfers run.
+struct razer_emu {
+	struct razer_device razer_dev;
+	struct usb_device   usb_dev;   // Placeholder. Never used for I/O.
+	struct usb_bus      usb_bus;
+
+	// Behaviour.
+	// status:        Final status of requests not covered by script.
+	// script:        Final statuses of the next script_len requests.
+	// busy:          BUSY responses before the final status of a request.
+	// delay_us:      Duration of a transfer.
+	// send_error:    Returned by SET_REPORT if not 0.
+	// receive_error: Returned by GET_REPORT if not 0.
+	enum razer_status status;
+	unsigned char     script[RAZER_EMU_SCRIPT_MAX];
+	uint              script_len;
+	uint              busy;
+	uint              delay_us;
+	int               send_error;
+	int               receive_error;
+
+	// Device state.
+	// seq_open: A row sequence was started but not finished.
+	struct razer_emu_pending pending[RAZER_INFLIGHT_MAX];
+	uint                     pending_count;
+	struct razer_report      response;  // Last response sent.
+	struct razer_report      last;      // Last request received.
+	bool                     seq_open;
+	unsigned char            effect;    // Last effect id set.
+	unsigned char matrix[RAZER_EMU_ROWS][RAZER_EMU_COLUMNS * 3];
+
+	// Counters.
+	uint sends;        // SET_REPORT transfers.
+	uint receives;     // GET_REPORT transfers.
+	uint rows;         // Row reports applied to the matrix.
+	uint sequences;    // Row sequences finished.
+	uint interleaved;  // Other requests inside an unfinished sequence.
+	uint bad_crc;      // Requests with a wrong checksum.
+	uint rejected;     // Row reports with invalid arguments.
+};
+
+//#################//
+//### Functions ###//
+//#################//
+
+int razer_emu_init(struct razer_emu *emu);
+void razer_emu_deinit(struct razer_emu *emu);
+void razer_emu_reset(struct razer_emu *emu);
+
+#endif // __HID_RAZER_EMU_H
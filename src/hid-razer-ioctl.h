@@ -0,0 +1,105 @@
+/*
+ * Razer Kernel Drivers
+ * Copyright (c) 2016 Roland Singer <roland.singer@desertbit.com>
+ * Based on Tim Theede <pez2001@voyagerproject.de> razer_chroma_drivers project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __HID_RAZER_IOCTL_H
+#define __HID_RAZER_IOCTL_H
+
+// Userspace interface of the per-device framebuffer character device
+// /dev/razer-fb-<hid-bus>:<vendor-id>:<product-id>.<num>
+// The framebuffer holds rows * columns RGB triplets, row by row.
+// It can be accessed with read, write and mmap.
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+//#############//
+//### Types ###//
+//#############//
+
+// rows:    Amount of key rows.
+// columns: Amount of key columns.
+// size:    Size of the framebuffer in bytes: rows * columns * 3.
+struct razer_fb_info {
+	__u32 rows;
+	__u32 columns;
+	__u32 size;
+	__u32 reserved;
+};
+
+// Size of a raw report as laid out by struct razer_report in
+// hid-razer-common.h.
+#define RAZER_REPORT_SIZE   90
+
+// Maximum amount of reports per batch.
+#define RAZER_BATCH_MAX     64
+
+// count:   Amount of reports, 1 to RAZER_BATCH_MAX.
+// flags:   Reserved, must be 0.
+// reports: Userspace pointer to count raw reports of RAZER_REPORT_SIZE
+//          bytes each. The driver fills in the status, protocol type,
+//          remaining packets and CRC fields. With an inflight_depth above
+//          1 the transaction id is replaced by the driver's tag as well.
+// status:  Userspace pointer to count __s32 values. Filled with 0 or a
+//          negative error code per report.
+struct razer_batch {
+	__u32 count;
+	__u32 flags;
+	__u64 reports;
+	__u64 status;
+};
+
+// Maximum amount of frames of an animation and duration of a frame.
+#define RAZER_ANIM_MAX_FRAMES       1024
+#define RAZER_ANIM_MAX_DURATION_MS  60000
+
+// Animation flags.
+#define RAZER_ANIM_LOOP     0x1  // Restart after the last frame.
+
+// count:     Amount of frames, 1 to RAZER_ANIM_MAX_FRAMES.
+// flags:     RAZER_ANIM_* flags. 0 plays the animation once.
+// frames:    Userspace pointer to count frames of razer_fb_info.size
+//            bytes each.
+// durations: Userspace pointer to count __u32 values. The time in
+//            milliseconds each frame is shown, 1 to
+//            RAZER_ANIM_MAX_DURATION_MS.
+struct razer_anim {
+	__u32 count;
+	__u32 flags;
+	__u64 frames;
+	__u64 durations;
+};
+
+//##############//
+//### Ioctls ###//
+//##############//
+
+#define RAZER_IOC_MAGIC     'Z'
+
+// Get the framebuffer geometry.
+#define RAZER_IOC_GET_INFO  _IOR(RAZER_IOC_MAGIC, 0x00, struct razer_fb_info)
+
+// Send the framebuffer to the device and switch to custom mode.
+#define RAZER_IOC_COMMIT    _IO(RAZER_IOC_MAGIC, 0x01)
+
+// Send raw reports back to back. Requires the file to be open for writing.
+#define RAZER_IOC_BATCH     _IOW(RAZER_IOC_MAGIC, 0x02, struct razer_batch)
+
+// Replace the stored animation. The player is stopped. Playback is
+// controlled through the "animation" device file. Requires the file to be
+// open for writing.
+#define RAZER_IOC_ANIM_LOAD _IOW(RAZER_IOC_MAGIC, 0x03, struct razer_anim)
+
+#endif // __HID_RAZER_IOCTL_H
@@ -0,0 +1,469 @@
+/*
+ * Razer Kernel Drivers
+ * Copyright (c) 2016 Roland Singer <roland.singer@desertbit.com>
+ * Based on Tim Theede <pez2001@voyagerproject.de> razer_chroma_drivers project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * KUnit suite of the keyboard commands. Included by hid-razer.c with
+ * CONFIG_HID_RAZER_KUNIT_TEST. Runs against the software device emulator
+ * of hid-razer-common.
+ */
+
+#include <kunit/test.h>
+
+#include "hid-razer-emu.h"
+
+//########################//
+//### Helper functions ###//
+//########################//
+
+static void razer_test_model_desc(const struct razer_model *model,
+				  char *desc)
+{
+	strscpy(desc, model->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(razer_test_model, razer_models, razer_test_model_desc);
+
+// Set up an emulated keyboard of a model.
+// It is released by razer_test_exit.
+static struct razer_emu *razer_test_device(struct kunit *test,
+					   const struct razer_model *model)
+{
+	struct razer_data *data;
+	struct razer_emu *emu;
+
+	emu  = kunit_kzalloc(test, sizeof(*emu), GFP_KERNEL);
+	data = kunit_kzalloc(test, sizeof(*data), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, emu);
+	KUNIT_ASSERT_NOT_NULL(test, data);
+
+	KUNIT_ASSERT_EQ(test, razer_emu_init(emu), 0);
+	test->priv = emu;
+
+	razer_init_data(data);
+	data->model            = model;
+	data->queue.razer_dev  = &emu->razer_dev;
+	emu->razer_dev.data    = data;
+
+	if (model->features & RAZER_FEATURE_KEY_COLORS) {
+		data->key_colors = kunit_kcalloc(test, model->rows,
+						 model->columns * 3,
+						 GFP_KERNEL);
+		KUNIT_ASSERT_NOT_NULL(test, data->key_colors);
+	}
+
+	return emu;
+}
+
+// Get a frame of a model with every byte set to value.
+static unsigned char *razer_test_frame(struct kunit *test,
+				       const struct razer_model *model,
+				       unsigned char value)
+{
+	unsigned char *frame;
+
+	frame = kunit_kmalloc_array(test, model->rows, model->columns * 3,
+				    GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, frame);
+	memset(frame, value, model->rows * model->columns * 3);
+
+	return frame;
+}
+
+// Check that the emulated matrix shows a frame.
+static void razer_test_expect_matrix(struct kunit *test,
+				     struct razer_emu *emu,
+				     const struct razer_model *model,
+				     unsigned char *frame)
+{
+	size_t row_len = model->columns * 3;
+	unsigned int row;
+
+	for (row = 0; row < model->rows; row++)
+		KUNIT_EXPECT_MEMEQ(test, emu->matrix[row],
+				   &frame[row * row_len], row_len);
+}
+
+// Check the last effect report sent.
+static void razer_test_expect_effect(struct kunit *test,
+				     struct razer_emu *emu,
+				     const unsigned char *args, size_t len)
+{
+	KUNIT_EXPECT_EQ(test, emu->last.command_class, 0x03);
+	KUNIT_EXPECT_EQ(test, emu->last.command_id, 0x0A);
+	KUNIT_EXPECT_EQ(test, emu->last.data_size, len);
+	KUNIT_EXPECT_MEMEQ(test, emu->last.arguments, args, len);
+	KUNIT_EXPECT_EQ(test, emu->effect, args[0]);
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 0);
+}
+
+static void razer_test_exit(struct kunit *test)
+{
+	if (test->priv)
+		razer_emu_deinit(test->priv);
+}
+
+//##################//
+//### Key Colors ###//
+//##################//
+
+// A row report addresses the columns start-end and carries their colors.
+static void razer_test_fill_key_row_report(struct kunit *test)
+{
+	unsigned char cols[9] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	struct razer_report report;
+
+	razer_fill_key_row_report(&report, 2, 3, 5, cols);
+
+	KUNIT_EXPECT_EQ(test, report.command_class, 0x03);
+	KUNIT_EXPECT_EQ(test, report.command_id, 0x0B);
+	KUNIT_EXPECT_EQ(test, report.data_size, 4 + sizeof(cols));
+	KUNIT_EXPECT_EQ(test, report.arguments[0], 0xFF);
+	KUNIT_EXPECT_EQ(test, report.arguments[1], 2);
+	KUNIT_EXPECT_EQ(test, report.arguments[2], 3);
+	KUNIT_EXPECT_EQ(test, report.arguments[3], 5);
+	KUNIT_EXPECT_MEMEQ(test, &report.arguments[4], cols, sizeof(cols));
+	KUNIT_EXPECT_EQ(test, report.crc, razer_calculate_crc(&report));
+}
+
+// Frames of the wrong size are rejected before any transfer.
+static void razer_test_key_colors_length(struct kunit *test)
+{
+	const struct razer_model *model = test->param_value;
+	struct razer_emu *emu           = razer_test_device(test, model);
+	size_t len                      = model->rows * model->columns * 3;
+	unsigned char *frame            = razer_test_frame(test, model, 0);
+
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame, 0),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len - 1), -EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len - model->columns * 3),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, emu->sends, 0);
+}
+
+// Models without key colors reject frames.
+static void razer_test_key_colors_unsupported(struct kunit *test)
+{
+	static const struct razer_model model = {
+		.name    = "No key colors",
+		.rows    = 0,
+		.columns = 0,
+	};
+	struct razer_emu *emu = razer_test_device(test, &model);
+	unsigned char frame[3];
+
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   sizeof(frame)), -EINVAL);
+	KUNIT_EXPECT_EQ(test, emu->sends, 0);
+}
+
+// The first frame uploads every row as one sequence.
+static void razer_test_key_colors_full(struct kunit *test)
+{
+	const struct razer_model *model = test->param_value;
+	struct razer_emu *emu           = razer_test_device(test, model);
+	size_t len                      = model->rows * model->columns * 3;
+	unsigned char *frame            = razer_test_frame(test, model, 0);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		frame[i] = i;
+
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len), 0);
+	KUNIT_EXPECT_EQ(test, emu->rows, model->rows);
+	KUNIT_EXPECT_EQ(test, emu->sequences, 1);
+	KUNIT_EXPECT_EQ(test, emu->rejected, 0);
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 0);
+	razer_test_expect_matrix(test, emu, model, frame);
+}
+
+// Only the changed span of changed rows is uploaded.
+static void razer_test_key_colors_diff(struct kunit *test)
+{
+	const struct razer_model *model = test->param_value;
+	struct razer_emu *emu           = razer_test_device(test, model);
+	size_t len                      = model->rows * model->columns * 3;
+	unsigned char *frame            = razer_test_frame(test, model, 0x20);
+	unsigned int row = model->rows - 1, column = model->columns / 2;
+	uint sends;
+
+	KUNIT_ASSERT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len), 0);
+
+	frame[(row * model->columns + column) * 3 + 1] = 0xFF;
+
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len), 0);
+	KUNIT_EXPECT_EQ(test, emu->rows, model->rows + 1);
+	KUNIT_EXPECT_EQ(test, emu->last.arguments[1], row);
+	KUNIT_EXPECT_EQ(test, emu->last.arguments[2], column);
+	KUNIT_EXPECT_EQ(test, emu->last.arguments[3], column);
+	razer_test_expect_matrix(test, emu, model, frame);
+
+	// An unchanged frame only settles the previous one.
+	sends = emu->sends;
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len), 0);
+	KUNIT_EXPECT_EQ(test, emu->sends, sends);
+}
+
+// A deferred row failure makes the next frame a full upload.
+static void razer_test_key_colors_failure(struct kunit *test)
+{
+	const struct razer_model *model = test->param_value;
+	struct razer_emu *emu           = razer_test_device(test, model);
+	size_t len                      = model->rows * model->columns * 3;
+	unsigned char *frame            = razer_test_frame(test, model, 0x20);
+
+	KUNIT_ASSERT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len), 0);
+
+	frame[0] = 0xFF;
+	emu->status = RAZER_STATUS_FAILURE;
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len), 0);
+	KUNIT_EXPECT_EQ(test, emu->rows, model->rows);
+
+	emu->status = RAZER_STATUS_SUCCESS;
+	KUNIT_EXPECT_EQ(test, razer_set_key_colors(&emu->razer_dev, frame,
+						   len), 0);
+	KUNIT_EXPECT_EQ(test, emu->rows, 2 * model->rows);
+	razer_test_expect_matrix(test, emu, model, frame);
+}
+
+// Custom mode is set after every committed frame.
+static void razer_test_commit_frame(struct kunit *test)
+{
+	static const unsigned char custom[] = { 0x05, 0x00 };
+	const struct razer_model *model = &razer_models[0];
+	struct razer_emu *emu           = razer_test_device(test, model);
+	size_t len                      = model->rows * model->columns * 3;
+	unsigned char *frame            = razer_test_frame(test, model, 0x40);
+
+	KUNIT_EXPECT_EQ(test, razer_commit_frame(&emu->razer_dev, frame, len),
+			0);
+	razer_test_expect_effect(test, emu, custom, sizeof(custom));
+
+	emu->effect = 0x00;
+	frame[0]    = 0x41;
+
+	KUNIT_EXPECT_EQ(test, razer_commit_frame(&emu->razer_dev, frame, len),
+			0);
+	razer_test_expect_effect(test, emu, custom, sizeof(custom));
+}
+
+// A rejected last row of a committed frame is seen when custom mode is
+// sent, and the next frame is uploaded in full.
+static void razer_test_commit_frame_failure(struct kunit *test)
+{
+	const struct razer_model *model = &razer_models[0];
+	struct razer_emu *emu           = razer_test_device(test, model);
+	size_t len                      = model->rows * model->columns * 3;
+	unsigned char *frame            = razer_test_frame(test, model, 0x40);
+	unsigned int i;
+
+	for (i = 0; i <= model->rows; i++)
+		emu->script[i] = RAZER_STATUS_SUCCESS;
+	emu->script[model->rows - 1] = RAZER_STATUS_FAILURE;
+	emu->script_len              = model->rows + 1;
+
+	KUNIT_EXPECT_EQ(test, razer_commit_frame(&emu->razer_dev, frame, len),
+			0);
+	KUNIT_EXPECT_EQ(test, emu->rows, model->rows - 1);
+	KUNIT_EXPECT_EQ(test, emu->effect, 0x05);
+	KUNIT_EXPECT_EQ(test, razer_get_sticky_error(&emu->razer_dev, true),
+			-EINVAL);
+
+	KUNIT_EXPECT_EQ(test, razer_commit_frame(&emu->razer_dev, frame, len),
+			0);
+	KUNIT_EXPECT_EQ(test, emu->rows, 2 * model->rows - 1);
+	razer_test_expect_matrix(test, emu, model, frame);
+}
+
+//#############//
+//### Modes ###//
+//#############//
+
+// Every effect setter encodes its effect id and parameters.
+static void razer_test_mode_encoders(struct kunit *test)
+{
+	struct razer_emu *emu = razer_test_device(test, &razer_models[0]);
+	struct razer_device *razer_dev = &emu->razer_dev;
+	struct razer_rgb c1 = { 0x11, 0x12, 0x13 };
+	struct razer_rgb c2 = { 0x21, 0x22, 0x23 };
+
+	KUNIT_EXPECT_EQ(test, razer_set_none_mode(razer_dev), 0);
+	razer_test_expect_effect(test, emu, (unsigned char []){ 0x00 }, 1);
+
+	KUNIT_EXPECT_EQ(test, razer_set_static_mode(razer_dev, &c1), 0);
+	razer_test_expect_effect(test, emu,
+				 (unsigned char []){ 0x06, 0x11, 0x12, 0x13 },
+				 4);
+
+	KUNIT_EXPECT_EQ(test, razer_set_custom_mode(razer_dev), 0);
+	razer_test_expect_effect(test, emu, (unsigned char []){ 0x05, 0x00 },
+				 2);
+
+	KUNIT_EXPECT_EQ(test, razer_set_wave_mode(razer_dev, 2), 0);
+	razer_test_expect_effect(test, emu, (unsigned char []){ 0x01, 0x02 },
+				 2);
+
+	KUNIT_EXPECT_EQ(test, razer_set_spectrum_mode(razer_dev), 0);
+	razer_test_expect_effect(test, emu, (unsigned char []){ 0x04 }, 1);
+
+	KUNIT_EXPECT_EQ(test, razer_set_reactive_mode(razer_dev, 2, &c1), 0);
+	razer_test_expect_effect(test, emu,
+				 (unsigned char []){ 0x02, 0x02,
+						     0x11, 0x12, 0x13 },
+				 5);
+
+	KUNIT_EXPECT_EQ(test, razer_set_starlight_mode(razer_dev, 3, NULL,
+						       NULL), 0);
+	razer_test_expect_effect(test, emu,
+				 (unsigned char []){ 0x19, 0x03, 0x03 }, 3);
+
+	KUNIT_EXPECT_EQ(test, razer_set_starlight_mode(razer_dev, 1, &c1,
+						       NULL), 0);
+	razer_test_expect_effect(test, emu,
+				 (unsigned char []){ 0x19, 0x01, 0x01,
+						     0x11, 0x12, 0x13 },
+				 6);
+
+	KUNIT_EXPECT_EQ(test, razer_set_starlight_mode(razer_dev, 2, &c1,
+						       &c2), 0);
+	razer_test_expect_effect(test, emu,
+				 (unsigned char []){ 0x19, 0x02, 0x02,
+						     0x11, 0x12, 0x13,
+						     0x21, 0x22, 0x23 },
+				 9);
+
+	KUNIT_EXPECT_EQ(test, razer_set_breath_mode(razer_dev, NULL, NULL), 0);
+	razer_test_expect_effect(test, emu, (unsigned char []){ 0x03, 0x03 },
+				 2);
+
+	KUNIT_EXPECT_EQ(test, razer_set_breath_mode(razer_dev, &c1, NULL), 0);
+	razer_test_expect_effect(test, emu,
+				 (unsigned char []){ 0x03, 0x01,
+						     0x11, 0x12, 0x13 },
+				 5);
+
+	KUNIT_EXPECT_EQ(test, razer_set_breath_mode(razer_dev, &c1, &c2), 0);
+	razer_test_expect_effect(test, emu,
+				 (unsigned char []){ 0x03, 0x02,
+						     0x11, 0x12, 0x13,
+						     0x21, 0x22, 0x23 },
+				 8);
+}
+
+// Invalid effect parameters are rejected before any transfer.
+static void razer_test_mode_invalid(struct kunit *test)
+{
+	struct razer_emu *emu = razer_test_device(test, &razer_models[0]);
+	struct razer_device *razer_dev = &emu->razer_dev;
+	struct razer_rgb c = { 0x11, 0x12, 0x13 };
+
+	KUNIT_EXPECT_EQ(test, razer_set_wave_mode(razer_dev, 0), -EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_set_wave_mode(razer_dev, 3), -EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_set_reactive_mode(razer_dev, 0, &c),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_set_reactive_mode(razer_dev, 4, &c),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_set_starlight_mode(razer_dev, 0, NULL,
+						       NULL), -EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_set_starlight_mode(razer_dev, 1, NULL,
+						       &c), -EINVAL);
+	KUNIT_EXPECT_EQ(test, razer_set_breath_mode(razer_dev, NULL, &c),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, emu->sends, 0);
+}
+
+// The brightness command follows the encoding of the model.
+static void razer_test_brightness(struct kunit *test)
+{
+	const struct razer_model *model        = test->param_value;
+	const struct razer_brightness_cmd *cmd = &model->brightness;
+	struct razer_emu *emu                  = razer_test_device(test, model);
+
+	KUNIT_EXPECT_EQ(test, razer_set_brightness(&emu->razer_dev, 0x80), 0);
+	KUNIT_EXPECT_EQ(test, emu->last.command_class, cmd->command_class);
+	KUNIT_EXPECT_EQ(test, emu->last.command_id, cmd->set_id);
+	KUNIT_EXPECT_EQ(test, emu->last.data_size, cmd->args_len + 1);
+	KUNIT_EXPECT_MEMEQ(test, emu->last.arguments, cmd->args,
+			   cmd->args_len);
+	KUNIT_EXPECT_EQ(test, emu->last.arguments[cmd->args_len], 0x80);
+	KUNIT_EXPECT_EQ(test, emu->bad_crc, 0);
+}
+
+// Brightness is confirmed even if its command class is deferred, so a
+// rejected value is never cached.
+static void razer_test_brightness_deferred(struct kunit *test)
+{
+	const struct razer_model *model;
+	struct razer_emu *emu;
+	struct razer_data *data;
+
+	model = razer_find_model(USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA);
+	KUNIT_ASSERT_NOT_NULL(test, model);
+
+	emu  = razer_test_device(test, model);
+	data = emu->razer_dev.data;
+
+	KUNIT_ASSERT_EQ(test, model->brightness.command_class, 0x03);
+	KUNIT_ASSERT_EQ(test, razer_get_policy(&emu->razer_dev, 0x03),
+			RAZER_POLICY_DEFERRED);
+
+	emu->status = RAZER_STATUS_FAILURE;
+	KUNIT_EXPECT_EQ(test, razer_set_brightness(&emu->razer_dev, 0x80),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, emu->receives, 1);
+	KUNIT_EXPECT_EQ(test, data->brightness, -1);
+
+	emu->status = RAZER_STATUS_SUCCESS;
+	KUNIT_EXPECT_EQ(test, razer_set_brightness(&emu->razer_dev, 0x40), 0);
+	KUNIT_EXPECT_EQ(test, emu->receives, 2);
+	KUNIT_EXPECT_EQ(test, data->brightness, 0x40);
+}
+
+static struct kunit_case razer_test_cases[] = {
+	KUNIT_CASE(razer_test_fill_key_row_report),
+	KUNIT_CASE_PARAM(razer_test_key_colors_length,
+			 razer_test_model_gen_params),
+	KUNIT_CASE(razer_test_key_colors_unsupported),
+	KUNIT_CASE_PARAM(razer_test_key_colors_full,
+			 razer_test_model_gen_params),
+	KUNIT_CASE_PARAM(razer_test_key_colors_diff,
+			 razer_test_model_gen_params),
+	KUNIT_CASE_PARAM(razer_test_key_colors_failure,
+			 razer_test_model_gen_params),
+	KUNIT_CASE(razer_test_commit_frame),
+	KUNIT_CASE(razer_test_commit_frame_failure),
+	KUNIT_CASE(razer_test_mode_encoders),
+	KUNIT_CASE(razer_test_mode_invalid),
+	KUNIT_CASE_PARAM(razer_test_brightness, razer_test_model_gen_params),
+	KUNIT_CASE(razer_test_brightness_deferred),
+	{}
+};
+
+static struct kunit_suite razer_test_suite = {
+	.name       = "hid-razer",
+	.exit       = razer_test_exit,
+	.test_cases = razer_test_cases,
+};
+
+kunit_test_suite(razer_test_suite);
@@ -0,0 +1,163 @@
+/*
+ * Razer Kernel Drivers
+ * Copyright (c) 2016 Roland Singer <roland.singer@desertbit.com>
+ * Based on Tim Theede <pez2001@voyagerproject.de> razer_chroma_drivers project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Trace events of the report transport.
+// Enable them with: trace-cmd record -e razer
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM razer
+
+#if !defined(__HID_RAZER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __HID_RAZER_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/usb.h>
+
+#include "hid-razer-common.h"
+
+// A single USB control transfer.
+// pace_ns:     Time spent waiting for the pacing gap.
+// duration_ns: Time spent in the transfer itself.
+DECLARE_EVENT_CLASS(razer_transfer,
+	TP_PROTO(struct razer_device *razer_dev, struct razer_report *report,
+		 s64 pace_ns, s64 duration_ns, int retval),
+	TP_ARGS(razer_dev, report, pace_ns, duration_ns, retval),
+
+	TP_STRUCT__entry(
+		__field(int,            busnum)
+		__field(int,            devnum)
+		__field(unsigned char,  status)
+		__field(unsigned char,  transaction_id)
+		__field(unsigned char,  command_class)
+		__field(unsigned char,  command_id)
+		__field(s64,            pace_ns)
+		__field(s64,            duration_ns)
+		__field(int,            retval)
+	),
+
+	TP_fast_assign(
+		__entry->busnum         = razer_dev->usb_dev->bus->busnum;
+		__entry->devnum         = razer_dev->usb_dev->devnum;
+		__entry->status         = report->status;
+		__entry->transaction_id = report->transaction_id;
+		__entry->command_class  = report->command_class;
+		__entry->command_id     = report->command_id;
+		__entry->pace_ns        = pace_ns;
+		__entry->duration_ns    = duration_ns;
+		__entry->retval         = retval;
+	),
+
+	TP_printk("usb %d-%d class=0x%02x id=0x%02x tid=0x%02x status=0x%02x "
+		  "pace=%lldns duration=%lldns retval=%d",
+		  __entry->busnum, __entry->devnum,
+		  __entry->command_class, __entry->command_id,
+		  __entry->transaction_id, __entry->status,
+		  __entry->pace_ns, __entry->duration_ns, __entry->retval)
+);
+
+DEFINE_EVENT(razer_transfer, razer_send,
+	TP_PROTO(struct razer_device *razer_dev, struct razer_report *report,
+		 s64 pace_ns, s64 duration_ns, int retval),
+	TP_ARGS(razer_dev, report, pace_ns, duration_ns, retval)
+);
+
+DEFINE_EVENT(razer_transfer, razer_receive,
+	TP_PROTO(struct razer_device *razer_dev, struct razer_report *report,
+		 s64 pace_ns, s64 duration_ns, int retval),
+	TP_ARGS(razer_dev, report, pace_ns, duration_ns, retval)
+);
+
+// The device answered with BUSY and is polled again after delay_us.
+TRACE_EVENT(razer_busy_retry,
+	TP_PROTO(struct razer_device *razer_dev, struct razer_report *request,
+		 uint poll, uint delay_us),
+	TP_ARGS(razer_dev, request, poll, delay_us),
+
+	TP_STRUCT__entry(
+		__field(int,            busnum)
+		__field(int,            devnum)
+		__field(unsigned char,  transaction_id)
+		__field(unsigned char,  command_class)
+		__field(unsigned char,  command_id)
+		__field(uint,           poll)
+		__field(uint,           delay_us)
+	),
+
+	TP_fast_assign(
+		__entry->busnum         = razer_dev->usb_dev->bus->busnum;
+		__entry->devnum         = razer_dev->usb_dev->devnum;
+		__entry->transaction_id = request->transaction_id;
+		__entry->command_class  = request->command_class;
+		__entry->command_id     = request->command_id;
+		__entry->poll           = poll;
+		__entry->delay_us       = delay_us;
+	),
+
+	TP_printk("usb %d-%d class=0x%02x id=0x%02x tid=0x%02x poll=%u "
+		  "delay=%uus",
+		  __entry->busnum, __entry->devnum,
+		  __entry->command_class, __entry->command_id,
+		  __entry->transaction_id, __entry->poll, __entry->delay_us)
+);
+
+// A request was answered or failed.
+// lock_ns:     Time spent waiting for razer_device.lock.
+// duration_ns: Time from sending the request to the final response.
+TRACE_EVENT(razer_complete,
+	TP_PROTO(struct razer_device *razer_dev, struct razer_report *request,
+		 s64 lock_ns, s64 duration_ns, uint polls, int retval),
+	TP_ARGS(razer_dev, request, lock_ns, duration_ns, polls, retval),
+
+	TP_STRUCT__entry(
+		__field(int,            busnum)
+		__field(int,            devnum)
+		__field(unsigned char,  transaction_id)
+		__field(unsigned char,  command_class)
+		__field(unsigned char,  command_id)
+		__field(s64,            lock_ns)
+		__field(s64,            duration_ns)
+		__field(uint,           polls)
+		__field(int,            retval)
+	),
+
+	TP_fast_assign(
+		__entry->busnum         = razer_dev->usb_dev->bus->busnum;
+		__entry->devnum         = razer_dev->usb_dev->devnum;
+		__entry->transaction_id = request->transaction_id;
+		__entry->command_class  = request->command_class;
+		__entry->command_id     = request->command_id;
+		__entry->lock_ns        = lock_ns;
+		__entry->duration_ns    = duration_ns;
+		__entry->polls          = polls;
+		__entry->retval         = retval;
+	),
+
+	TP_printk("usb %d-%d class=0x%02x id=0x%02x tid=0x%02x lock=%lldns "
+		  "duration=%lldns polls=%u retval=%d",
+		  __entry->busnum, __entry->devnum,
+		  __entry->command_class, __entry->command_id,
+		  __entry->transaction_id, __entry->lock_ns,
+		  __entry->duration_ns, __entry->polls, __entry->retval)
+);
+
+#endif // __HID_RAZER_TRACE_H
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hid-razer-trace
+
+#include <trace/define_trace.h>
@@ -24,10 +24,16 @@
 #include <linux/usb/input.h>
 #include <linux/hid.h>
 #include <linux/dmi.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/ctype.h>
 
 #include "hid-ids.h"
 #include "hid-razer-common.h"
 #include "hid-razer.h"
+#include "hid-razer-ioctl.h"
 
 //###########################//
 //### Version Information ###//
@@ -38,6 +44,163 @@ MODULE_DESCRIPTION("USB HID Razer Driver");
 MODULE_LICENSE("GPL v2");
 MODULE_VERSION("1.0.0");
 
+//#####################//
+//### Device Models ###//
+//#####################//
+
+#define RAZER_EFFECTS_BLADE  (BIT(RAZER_EFFECT_NONE)      | \
+			      BIT(RAZER_EFFECT_STATIC)    | \
+			      BIT(RAZER_EFFECT_CUSTOM)    | \
+			      BIT(RAZER_EFFECT_WAVE)      | \
+			      BIT(RAZER_EFFECT_SPECTRUM)  | \
+			      BIT(RAZER_EFFECT_REACTIVE)  | \
+			      BIT(RAZER_EFFECT_STARLIGHT) | \
+			      BIT(RAZER_EFFECT_BREATH))
+
+#define RAZER_EFFECTS_BLACKWIDOW  (RAZER_EFFECTS_BLADE & \
+				   ~BIT(RAZER_EFFECT_STARLIGHT))
+
+// LED matrix positions of the Blade Stealth and Blade 14 keys.
+static const struct razer_key_pos razer_keys_blade[] = {
+	// Esc, F1-F12, Insert, Delete
+	{ 0x29, 0,  0 }, { 0x3A, 0,  1 }, { 0x3B, 0,  2 }, { 0x3C, 0,  3 },
+	{ 0x3D, 0,  4 }, { 0x3E, 0,  5 }, { 0x3F, 0,  6 }, { 0x40, 0,  7 },
+	{ 0x41, 0,  8 }, { 0x42, 0,  9 }, { 0x43, 0, 10 }, { 0x44, 0, 11 },
+	{ 0x45, 0, 12 }, { 0x49, 0, 13 }, { 0x4C, 0, 14 },
+
+	// `, 1-0, -, =, Backspace
+	{ 0x35, 1,  0 }, { 0x1E, 1,  1 }, { 0x1F, 1,  2 }, { 0x20, 1,  3 },
+	{ 0x21, 1,  4 }, { 0x22, 1,  5 }, { 0x23, 1,  6 }, { 0x24, 1,  7 },
+	{ 0x25, 1,  8 }, { 0x26, 1,  9 }, { 0x27, 1, 10 }, { 0x2D, 1, 11 },
+	{ 0x2E, 1, 12 }, { 0x2A, 1, 13 },
+
+	// Tab, Q-P, [, ], backslash
+	{ 0x2B, 2,  0 }, { 0x14, 2,  1 }, { 0x1A, 2,  2 }, { 0x08, 2,  3 },
+	{ 0x15, 2,  4 }, { 0x17, 2,  5 }, { 0x1C, 2,  6 }, { 0x18, 2,  7 },
+	{ 0x0C, 2,  8 }, { 0x12, 2,  9 }, { 0x13, 2, 10 }, { 0x2F, 2, 11 },
+	{ 0x30, 2, 12 }, { 0x31, 2, 13 },
+
+	// Caps Lock, A-L, ;, ', Enter
+	{ 0x39, 3,  0 }, { 0x04, 3,  1 }, { 0x16, 3,  2 }, { 0x07, 3,  3 },
+	{ 0x09, 3,  4 }, { 0x0A, 3,  5 }, { 0x0B, 3,  6 }, { 0x0D, 3,  7 },
+	{ 0x0E, 3,  8 }, { 0x0F, 3,  9 }, { 0x33, 3, 10 }, { 0x34, 3, 11 },
+	{ 0x28, 3, 13 },
+
+	// Shift, Z-M, ",", ., /, Shift
+	{ 0xE1, 4,  0 }, { 0x1D, 4,  2 }, { 0x1B, 4,  3 }, { 0x06, 4,  4 },
+	{ 0x19, 4,  5 }, { 0x05, 4,  6 }, { 0x11, 4,  7 }, { 0x10, 4,  8 },
+	{ 0x36, 4,  9 }, { 0x37, 4, 10 }, { 0x38, 4, 11 }, { 0xE5, 4, 13 },
+
+	// Ctrl, Super, Alt, Space, Alt, Ctrl, arrows
+	{ 0xE0, 5,  0 }, { 0xE3, 5,  2 }, { 0xE2, 5,  3 }, { 0x2C, 5,  7 },
+	{ 0xE6, 5,  9 }, { 0xE4, 5, 10 }, { 0x50, 5, 11 }, { 0x52, 5, 12 },
+	{ 0x51, 5, 13 }, { 0x4F, 5, 14 },
+};
+
+// LED matrix positions of the BlackWidow Chroma keys.
+static const struct razer_key_pos razer_keys_blackwidow[] = {
+	// Esc, F1-F12, Print, Scroll Lock, Pause
+	{ 0x29, 0,  1 }, { 0x3A, 0,  3 }, { 0x3B, 0,  4 }, { 0x3C, 0,  5 },
+	{ 0x3D, 0,  6 }, { 0x3E, 0,  7 }, { 0x3F, 0,  8 }, { 0x40, 0,  9 },
+	{ 0x41, 0, 10 }, { 0x42, 0, 11 }, { 0x43, 0, 12 }, { 0x44, 0, 13 },
+	{ 0x45, 0, 14 }, { 0x46, 0, 15 }, { 0x47, 0, 16 }, { 0x48, 0, 17 },
+
+	// `, 1-0, -, =, Backspace, Insert, Home, Page Up, Num Lock, /, *, -
+	{ 0x35, 1,  1 }, { 0x1E, 1,  2 }, { 0x1F, 1,  3 }, { 0x20, 1,  4 },
+	{ 0x21, 1,  5 }, { 0x22, 1,  6 }, { 0x23, 1,  7 }, { 0x24, 1,  8 },
+	{ 0x25, 1,  9 }, { 0x26, 1, 10 }, { 0x27, 1, 11 }, { 0x2D, 1, 12 },
+	{ 0x2E, 1, 13 }, { 0x2A, 1, 14 }, { 0x49, 1, 15 }, { 0x4A, 1, 16 },
+	{ 0x4B, 1, 17 }, { 0x53, 1, 18 }, { 0x54, 1, 19 }, { 0x55, 1, 20 },
+	{ 0x56, 1, 21 },
+
+	// Tab, Q-P, [, ], backslash, Delete, End, Page Down, 7-9, +
+	{ 0x2B, 2,  1 }, { 0x14, 2,  2 }, { 0x1A, 2,  3 }, { 0x08, 2,  4 },
+	{ 0x15, 2,  5 }, { 0x17, 2,  6 }, { 0x1C, 2,  7 }, { 0x18, 2,  8 },
+	{ 0x0C, 2,  9 }, { 0x12, 2, 10 }, { 0x13, 2, 11 }, { 0x2F, 2, 12 },
+	{ 0x30, 2, 13 }, { 0x31, 2, 14 }, { 0x4C, 2, 15 }, { 0x4D, 2, 16 },
+	{ 0x4E, 2, 17 }, { 0x5F, 2, 18 }, { 0x60, 2, 19 }, { 0x61, 2, 20 },
+	{ 0x57, 2, 21 },
+
+	// Caps Lock, A-L, ;, ', Enter, 4-6
+	{ 0x39, 3,  1 }, { 0x04, 3,  2 }, { 0x16, 3,  3 }, { 0x07, 3,  4 },
+	{ 0x09, 3,  5 }, { 0x0A, 3,  6 }, { 0x0B, 3,  7 }, { 0x0D, 3,  8 },
+	{ 0x0E, 3,  9 }, { 0x0F, 3, 10 }, { 0x33, 3, 11 }, { 0x34, 3, 12 },
+	{ 0x28, 3, 14 }, { 0x5C, 3, 18 }, { 0x5D, 3, 19 }, { 0x5E, 3, 20 },
+
+	// Shift, backslash, Z-M, ",", ., /, Shift, Up, 1-3, Enter
+	{ 0xE1, 4,  1 }, { 0x64, 4,  2 }, { 0x1D, 4,  3 }, { 0x1B, 4,  4 },
+	{ 0x06, 4,  5 }, { 0x19, 4,  6 }, { 0x05, 4,  7 }, { 0x11, 4,  8 },
+	{ 0x10, 4,  9 }, { 0x36, 4, 10 }, { 0x37, 4, 11 }, { 0x38, 4, 12 },
+	{ 0xE5, 4, 14 }, { 0x52, 4, 16 }, { 0x59, 4, 18 }, { 0x5A, 4, 19 },
+	{ 0x5B, 4, 20 }, { 0x58, 4, 21 },
+
+	// Ctrl, Super, Alt, Space, Alt, Menu, Ctrl, Left, Down, Right, 0, .
+	{ 0xE0, 5,  1 }, { 0xE3, 5,  2 }, { 0xE2, 5,  3 }, { 0x2C, 5,  7 },
+	{ 0xE6, 5, 11 }, { 0x65, 5, 13 }, { 0xE4, 5, 14 }, { 0x50, 5, 15 },
+	{ 0x51, 5, 16 }, { 0x4F, 5, 17 }, { 0x62, 5, 19 }, { 0x63, 5, 20 },
+};
+
+static const struct razer_model razer_models[] = {
+	{
+		.product_id       = USB_DEVICE_ID_RAZER_BLADE_STEALTH_2016,
+		.name             = "Razer Blade Stealth 2016",
+		.rows             = RAZER_STEALTH_2016_ROWS,
+		.columns          = RAZER_STEALTH_2016_COLUMNS,
+		.features         = RAZER_FEATURE_FN_MODE |
+				    RAZER_FEATURE_LOGO |
+				    RAZER_FEATURE_KEY_COLORS,
+		.effects          = RAZER_EFFECTS_BLADE,
+		.brightness       = { 0x0E, 0x84, 0x04, { 0x01 }, 1 },
+		.keys             = razer_keys_blade,
+		.keys_len         = ARRAY_SIZE(razer_keys_blade),
+		.fn_mode_state    = 1,
+		.macro_keys_state = -1,
+	},
+	{
+		.product_id       = USB_DEVICE_ID_RAZER_BLADE_14_2016,
+		.name             = "Razer Blade 14 2016",
+		.rows             = RAZER_BLADE_14_2016_ROWS,
+		.columns          = RAZER_BLADE_14_2016_COLUMNS,
+		.features         = RAZER_FEATURE_FN_MODE |
+				    RAZER_FEATURE_LOGO |
+				    RAZER_FEATURE_KEY_COLORS,
+		.effects          = RAZER_EFFECTS_BLADE,
+		.brightness       = { 0x0E, 0x84, 0x04, { 0x01 }, 1 },
+		.keys             = razer_keys_blade,
+		.keys_len         = ARRAY_SIZE(razer_keys_blade),
+		.fn_mode_state    = 1,
+		.macro_keys_state = -1,
+	},
+	{
+		.product_id       = USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA,
+		.name             = "Razer BlackWidow Chroma",
+		.rows             = RAZER_BLACKWIDOW_CHROMA_ROWS,
+		.columns          = RAZER_BLACKWIDOW_CHROMA_COLUMNS,
+		.features         = RAZER_FEATURE_KEY_COLORS |
+				    RAZER_FEATURE_MACRO_KEYS,
+		.effects          = RAZER_EFFECTS_BLACKWIDOW,
+		// Variable storage and backlight LED.
+		.brightness       = { 0x03, 0x83, 0x03, { 0x01, 0x05 }, 2 },
+		.keys             = razer_keys_blackwidow,
+		.keys_len         = ARRAY_SIZE(razer_keys_blackwidow),
+		.fn_mode_state    = -1,
+		.macro_keys_state = 1,
+	},
+};
+
+// Find the model of a product id.
+// Returns NULL if the product is not supported.
+const struct razer_model *razer_find_model(unsigned short product_id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(razer_models); i++)
+		if (razer_models[i].product_id == product_id)
+			return &razer_models[i];
+
+	return NULL;
+}
+
 //########################//
 //### Helper functions ###//
 //########################//
@@ -76,26 +239,15 @@ int razer_get_firmware_version(struct razer_device *razer_dev,
 int razer_get_brightness(struct razer_device *razer_dev)
 {
 	int retval;
-	struct usb_device *usb_dev          = razer_dev->usb_dev;
-	struct razer_report request_report  = razer_new_report();
+	struct razer_data *data                 = razer_dev->data;
+	const struct razer_brightness_cmd *cmd  = &data->model->brightness;
+	struct razer_report request_report      = razer_new_report();
 	struct razer_report response_report;
-	int response_value_index            = 1;
-	const unsigned int product_id       = usb_dev->descriptor.idProduct;
-
-	request_report.command_class = 0x0E;
-	request_report.command_id    = 0x84;
-	request_report.data_size     = 0x01;
-	request_report.arguments[0]  = 0x01;     // LED Class
-
-	// Device support.
-	if (product_id == USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA) {
-		request_report.command_class    = 0x03;
-		request_report.command_id       = 0x83;
-		request_report.arguments[1]     = 0x05;     // Backlight LED
-		request_report.data_size        = 0x02;
-		response_value_index            = 2;
-	}
 
+	request_report.command_class = cmd->command_class;
+	request_report.command_id    = cmd->get_id;
+	request_report.data_size     = cmd->args_len;
+	memcpy(request_report.arguments, cmd->args, cmd->args_len);
 	request_report.crc = razer_calculate_crc(&request_report);
 
 	retval = razer_send_with_response(razer_dev,
@@ -106,7 +258,7 @@ int razer_get_brightness(struct razer_device *razer_dev)
 		return retval;
 	}
 
-	return response_report.arguments[response_value_index];
+	return response_report.arguments[cmd->args_len];
 }
 
 // Set the keyboard brightness.
@@ -114,28 +266,27 @@ int razer_set_brightness(struct razer_device *razer_dev,
 			 unsigned char brightness)
 {
 	int retval;
-	struct usb_device *usb_dev    = razer_dev->usb_dev;
-	struct razer_report report    = razer_new_report();
-	const unsigned int product_id = usb_dev->descriptor.idProduct;
-
-	report.command_class = 0x0E;
-	report.command_id    = 0x04;
-	report.data_size     = 0x02;
-	report.arguments[0]  = 0x01;
-	report.arguments[1]  = brightness;
+	struct razer_data *data                 = razer_dev->data;
+	const struct razer_brightness_cmd *cmd  = &data->model->brightness;
+	struct razer_report report              = razer_new_report();
+	struct razer_report response;
+
+	report.command_class = cmd->command_class;
+	report.command_id    = cmd->set_id;
+	report.data_size     = cmd->args_len + 1;
+	memcpy(report.arguments, cmd->args, cmd->args_len);
+	report.arguments[cmd->args_len] = brightness;
+	report.crc = razer_calculate_crc(&report);
 
-	// Device support.
-	if (product_id == USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA) {
-		report.command_class    = 0x03;
-		report.command_id       = 0x03;
-		report.arguments[1]     = 0x05;     // Backlight LED
-		report.arguments[2]     = brightness;
-		report.data_size        = 0x03;
-	}
+	// Always wait for the response, even if the command class is
+	// deferred, so the cache never holds a value the device rejected.
+	retval = razer_send_with_response(razer_dev, &report, &response);
 
-	report.crc = razer_calculate_crc(&report);
+	// Write-through cache. Forget the value if the device rejected it.
+	mutex_lock(&data->cache_lock);
+	data->brightness = (retval == 0) ? brightness : -1;
+	mutex_unlock(&data->cache_lock);
 
-	retval = razer_send_check_response(razer_dev, &report);
 	if (retval != 0) {
 		razer_print_err_report(&report, KBUILD_MODNAME,
 				       "set_brightness: request failed");
@@ -207,99 +358,153 @@ int razer_set_fn_mode(struct razer_device *razer_dev, unsigned char state)
 	return 0;
 }
 
-// Returns the row count of the keyboard.
-// On error a value smaller than 0 is returned.
-int razer_get_rows(struct usb_device *usb_dev)
+// Forget all state the driver assumes the device is in.
+// Used after the device may have changed it behind our back.
+void razer_invalidate_state(struct razer_data *data)
+{
+	mutex_lock(&data->key_colors_lock);
+	data->key_colors_valid = false;
+	mutex_unlock(&data->key_colors_lock);
+
+	mutex_lock(&data->cache_lock);
+	data->brightness = -1;
+	mutex_unlock(&data->cache_lock);
+}
+
+// Query the firmware version, serial and brightness and cache them.
+// Values the device does not return stay unknown. Returns the first error.
+int razer_refresh_cache(struct razer_device *razer_dev)
 {
-	switch (usb_dev->descriptor.idProduct) {
-	case USB_DEVICE_ID_RAZER_BLADE_STEALTH_2016:
-		return RAZER_STEALTH_2016_ROWS;
+	struct razer_data *data = razer_dev->data;
+	const char *serial;
+	char fw_string[16] = "";
+	int brightness, retval;
 
-	case USB_DEVICE_ID_RAZER_BLADE_14_2016:
-		return RAZER_BLADE_14_2016_ROWS;
+	// Stealth and the Blade does not have serial via USB,
+	// so get it from the DMI table.
+	serial = dmi_get_system_info(DMI_PRODUCT_SERIAL);
 
-	case USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA:
-		return RAZER_BLACKWIDOW_CHROMA_ROWS;
+	retval     = razer_get_firmware_version(razer_dev, &fw_string[0]);
+	brightness = razer_get_brightness(razer_dev);
 
-	default:
+	mutex_lock(&data->cache_lock);
+	strscpy(data->serial, serial ? serial : "", sizeof(data->serial));
+	strscpy(data->fw_version, fw_string, sizeof(data->fw_version));
+	data->brightness = brightness;
+	mutex_unlock(&data->cache_lock);
+
+	if (retval != 0)
+		return retval;
+
+	return (brightness < 0) ? brightness : 0;
+}
+
+// Wrappers of the queries for razer_queue_call.
+static int razer_call_refresh_cache(struct razer_device *razer_dev, void *arg)
+{
+	return razer_refresh_cache(razer_dev);
+}
+
+static int razer_call_get_firmware_version(struct razer_device *razer_dev,
+					   void *arg)
+{
+	return razer_get_firmware_version(razer_dev, arg);
+}
+
+static int razer_call_get_brightness(struct razer_device *razer_dev,
+				     void *arg)
+{
+	return razer_get_brightness(razer_dev);
+}
+
+// Returns the row count of the keyboard.
+// On error a value smaller than 0 is returned.
+int razer_get_rows(struct razer_device *razer_dev)
+{
+	struct razer_data *data = razer_dev->data;
+
+	if (!(data->model->features & RAZER_FEATURE_KEY_COLORS))
 		return -EINVAL;
-	}
+
+	return data->model->rows;
 }
 
 // Returns the column count of the keyboard.
 // On error a value smaller than 0 is returned.
-int razer_get_columns(struct usb_device *usb_dev)
+int razer_get_columns(struct razer_device *razer_dev)
 {
-	switch (usb_dev->descriptor.idProduct) {
-	case USB_DEVICE_ID_RAZER_BLADE_STEALTH_2016:
-		return RAZER_STEALTH_2016_COLUMNS;
+	struct razer_data *data = razer_dev->data;
 
-	case USB_DEVICE_ID_RAZER_BLADE_14_2016:
-		return RAZER_BLADE_14_2016_COLUMNS;
+	if (!(data->model->features & RAZER_FEATURE_KEY_COLORS))
+		return -EINVAL;
 
-	case USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA:
-		return RAZER_BLACKWIDOW_CHROMA_COLUMNS;
+	return data->model->columns;
+}
 
-	default:
-		return -EINVAL;
-	}
+// Fill a custom frame report with the colors for the columns start-end
+// of a row. Takes in an array of RGB bytes.
+void razer_fill_key_row_report(struct razer_report *report,
+			       unsigned char row_index, unsigned char start,
+			       unsigned char end, unsigned char *cols)
+{
+	size_t cols_len = (end - start + 1) * 3;
+
+	*report = razer_new_report();
+	report->command_class  = 0x03;
+	report->command_id     = 0x0B;
+	report->data_size      = cols_len + 4;
+	report->transaction_id = 0x80;         // Set a custom transaction ID.
+	report->arguments[0]   = 0xFF;         // Frame ID
+	report->arguments[1]   = row_index;    // Row
+	report->arguments[2]   = start;        // Start Index
+	report->arguments[3]   = end;          // End Index
+	memcpy(&report->arguments[4], cols, cols_len);
+	report->crc            = razer_calculate_crc(report);
 }
 
-// Set the key colors for a specific row. Takes in an array of RGB bytes.
-int razer_set_key_row(struct razer_device *razer_dev, unsigned char row_index,
-		      unsigned char *row_cols, size_t row_cols_len)
+// Find the span of columns which differ between two rows of RGB bytes.
+// Returns false if both rows are equal.
+bool razer_diff_key_row(unsigned char *old_cols, unsigned char *new_cols,
+			int columns, unsigned char *start, unsigned char *end)
 {
-	int retval;
-	int rows                        = razer_get_rows(razer_dev->usb_dev);
-	int columns                     = razer_get_columns(razer_dev->usb_dev);
-	size_t row_cols_required_len    = columns * 3;
-	struct razer_report report      = razer_new_report();
+	int first, last;
 
-	if (rows < 0 || columns < 0) {
-		pr_warn("set_key_row: unsupported device\n");
-		return -EINVAL;
-	}
+	for (first = 0; first < columns; first++)
+		if (memcmp(&old_cols[first * 3], &new_cols[first * 3], 3) != 0)
+			break;
 
-	// Validate the input.
-	if (row_index >= rows) {
-		pr_warn("set_key_row: invalid row index: %d\n", row_index);
-		return -EINVAL;
-	}
-	if (row_cols_len != row_cols_required_len) {
-		pr_warn("set_key_row: wrong amount of RGB data provided: "
-			"%lu of %lu\n", row_cols_len, row_cols_required_len);
-		return -EINVAL;
-	}
+	if (first == columns)
+		return false;
 
-	report.command_class  = 0x03;
-	report.command_id     = 0x0B;
-	report.data_size      = row_cols_required_len + 4;
-	report.transaction_id = 0x80;         // Set a custom transaction ID.
-	report.arguments[0]   = 0xFF;         // Frame ID
-	report.arguments[1]   = row_index;    // Row
-	report.arguments[2]   = 0x00;         // Start Index
-	report.arguments[3]   = columns - 1;  // End Index (Calc to end of row)
-	memcpy(&report.arguments[4], row_cols, row_cols_required_len);
-	report.crc            = razer_calculate_crc(&report);
+	for (last = columns - 1; last > first; last--)
+		if (memcmp(&old_cols[last * 3], &new_cols[last * 3], 3) != 0)
+			break;
 
-	retval = razer_send_check_response(razer_dev, &report);
-	if (retval != 0) {
-		razer_print_err_report(&report, KBUILD_MODNAME,
-				       "set_key_row: request failed");
-		return retval;
-	}
+	*start = first;
+	*end   = last;
 
-	return retval;
+	return true;
 }
 
 // Set the key colors for the complete keyboard. Takes in an array of RGB bytes.
+// Only rows differing from the last committed frame are uploaded, each
+// limited to the span of changed columns. The rows are sent as one report
+// sequence, which is confirmed once.
+// Queued interactive commands pre-empt the upload between two rows.
+// Must be called from the device workqueue.
 int razer_set_key_colors(struct razer_device *razer_dev,
 			 unsigned char *row_cols, size_t row_cols_len)
 {
-	int i, retval;
-	int rows                        = razer_get_rows(razer_dev->usb_dev);
-	int columns                     = razer_get_columns(razer_dev->usb_dev);
-	size_t row_cols_required_len    = columns * 3 * rows;
+	int i, retval = 0;
+	struct razer_data *data         = razer_dev->data;
+	int rows                        = razer_get_rows(razer_dev);
+	int columns                     = razer_get_columns(razer_dev);
+	size_t row_len                  = columns * 3;
+	size_t row_cols_required_len    = row_len * rows;
+	unsigned char start, end;
+	struct razer_report *reports;
+	uint count = 0, done = 0, sent;
+	uint failures;
 
 	if (columns < 0 || rows < 0 || row_cols_required_len < 0) {
 		pr_warn("set_key_colors: unsupported device\n");
@@ -313,19 +518,63 @@ int razer_set_key_colors(struct razer_device *razer_dev,
 		return -EINVAL;
 	}
 
+	reports = kcalloc(rows, sizeof(*reports), GFP_KERNEL);
+	if (!reports)
+		return -ENOMEM;
+
+	mutex_lock(&data->key_colors_lock);
+
+	// The previous frame may not be confirmed yet. Don't diff against it
+	// if a deferred request failed in the meantime. Failures during this
+	// upload invalidate the shadow on the next frame.
+	failures = razer_settle(razer_dev);
+	if (failures != data->key_colors_failures)
+		data->key_colors_valid = false;
+
 	for (i = 0; i < rows; i++) {
-		retval =
-		razer_set_key_row(razer_dev, i,
-				  (unsigned char *)&row_cols[i * columns * 3],
-				   columns * 3);
-		if (retval != 0) {
-			pr_warn("set_key_colors: failed to set colors for row: "
-				"%d\n", i);
-			return retval;
-		}
+		start = 0;
+		end   = columns - 1;
+
+		if (data->key_colors_valid &&
+		    !razer_diff_key_row(&data->key_colors[i * row_len],
+					&row_cols[i * row_len], columns,
+					&start, &end))
+			continue;
+
+		razer_fill_key_row_report(&reports[count++], i, start, end,
+					  &row_cols[i * row_len + start * 3]);
 	}
 
-	return 0;
+	while (done < count) {
+		retval = razer_send_frame_preemptible(razer_dev, &reports[done],
+						      count - done,
+						      razer_queue_preempt, NULL,
+						      &sent);
+		if (retval != 0)
+			break;
+
+		done += sent;
+
+		// Serve the interactive lane before the rest of the frame.
+		if (done < count)
+			razer_queue_run(&data->queue, RAZER_CMD_INTERACTIVE);
+	}
+
+	if (retval != 0) {
+		razer_print_err_report(&reports[count - 1], KBUILD_MODNAME,
+				       "set_key_colors: frame upload failed");
+		data->key_colors_valid = false;
+	} else if (data->key_colors) {
+		memcpy(data->key_colors, row_cols, row_cols_required_len);
+		data->key_colors_valid    = true;
+		data->key_colors_failures = failures;
+	}
+
+	mutex_unlock(&data->key_colors_lock);
+
+	kfree(reports);
+
+	return retval;
 }
 
 // Enable keyboard macro keys.
@@ -615,235 +864,2175 @@ int razer_set_breath_mode(struct razer_device *razer_dev,
 	return 0;
 }
 
-//#########################//
-//### Device Attributes ###//
-//#########################//
+//#####################//
+//### Command Queue ###//
+//#####################//
 
-/*
- * Read device file "get_serial"
- * Gets the serial number from the device.
- * Returns a string.
- */
-static ssize_t razer_attr_read_get_serial(struct device *dev,
-					  struct device_attribute *attr,
-					  char *buf)
+// Remember the first error since the last flush.
+void razer_queue_set_error(struct razer_data *data, int error)
 {
-	char serial_string[100] = "";
+	unsigned long flags;
 
-	// Stealth and the Blade does not have serial via USB,
-	// so get it from the DMI table.
-	strcpy(serial_string, dmi_get_system_info(DMI_PRODUCT_SERIAL));
-	return sprintf(buf, "%s\n", &serial_string[0]);
+	spin_lock_irqsave(&data->queue.lock, flags);
+	if (data->queue.error == 0)
+		data->queue.error = error;
+	spin_unlock_irqrestore(&data->queue.lock, flags);
 }
 
-/**
- * Read device file "get_firmware_version"
- * Gets the firmware version from the device.
- * Returns a string.
- */
-static ssize_t
-razer_attr_read_get_firmware_version(struct device *dev,
-				     struct device_attribute *attr,
-				     char *buf)
+// Execute an effect command.
+static int razer_run_effect(struct razer_device *razer_dev,
+			    struct razer_cmd *cmd)
 {
-	struct razer_device *razer_dev  = dev_get_drvdata(dev);
-	char fw_string[100]             = "";
-	int retval;
+	struct razer_rgb *color1 = NULL;
+	struct razer_rgb *color2 = NULL;
 
-	retval = razer_get_firmware_version(razer_dev, &fw_string[0]);
-	if (retval != 0)
-		return retval;
+	switch (cmd->effect) {
+	case RAZER_EFFECT_NONE:
+		return razer_set_none_mode(razer_dev);
 
-	return sprintf(buf, "%s\n", &fw_string[0]);
-}
+	case RAZER_EFFECT_STATIC:
+		return razer_set_static_mode(razer_dev,
+					     (struct razer_rgb *)&cmd->args[0]);
 
-/*
- * Read device file "get_key_rows"
- * Returns the amount of key rows.
- */
-static ssize_t razer_attr_read_get_key_rows(struct device *dev,
-					    struct device_attribute *attr,
-					    char *buf)
-{
-	struct usb_interface *intf  = to_usb_interface(dev->parent);
-	struct usb_device *usb_dev  = interface_to_usbdev(intf);
-	int rows                    = razer_get_rows(usb_dev);
+	case RAZER_EFFECT_CUSTOM:
+		return razer_set_custom_mode(razer_dev);
 
-	return sprintf(buf, "%d\n", rows);
-}
+	case RAZER_EFFECT_WAVE:
+		return razer_set_wave_mode(razer_dev, cmd->args[0]);
 
-/*
- * Read device file "get_key_columns"
- * Returns the amount of key columns.
- */
-static ssize_t razer_attr_read_get_key_columns(struct device *dev,
-					       struct device_attribute *attr,
-					       char *buf)
-{
-	struct usb_interface *intf  = to_usb_interface(dev->parent);
-	struct usb_device *usb_dev  = interface_to_usbdev(intf);
-	int columns                 = razer_get_columns(usb_dev);
+	case RAZER_EFFECT_SPECTRUM:
+		return razer_set_spectrum_mode(razer_dev);
 
-	return sprintf(buf, "%d\n", columns);
+	case RAZER_EFFECT_REACTIVE:
+		return razer_set_reactive_mode(razer_dev, cmd->args[0],
+					       (struct razer_rgb *)&cmd->args[1]);
+
+	case RAZER_EFFECT_STARLIGHT:
+		if (cmd->len == 4) {
+			color1 = (struct razer_rgb *)&cmd->args[1];
+		} else if (cmd->len == 7) {
+			color1 = (struct razer_rgb *)&cmd->args[1];
+			color2 = (struct razer_rgb *)&cmd->args[4];
+		}
+		return razer_set_starlight_mode(razer_dev, cmd->args[0],
+						color1, color2);
+
+	case RAZER_EFFECT_BREATH:
+		if (cmd->len == 3) {
+			color1 = (struct razer_rgb *)&cmd->args[0];
+		} else if (cmd->len == 6) {
+			color1 = (struct razer_rgb *)&cmd->args[0];
+			color2 = (struct razer_rgb *)&cmd->args[3];
+		}
+		return razer_set_breath_mode(razer_dev, color1, color2);
+
+	default:
+		return -EINVAL;
+	}
 }
 
-/**
- * Read device file "device_type"
- * Returns a friendly device type string.
- */
-static ssize_t razer_attr_read_device_type(struct device *dev,
-					   struct device_attribute *attr,
-					   char *buf)
+// Execute a queued command.
+static int razer_run_cmd(struct razer_device *razer_dev,
+			 enum razer_cmd_type type, struct razer_cmd *cmd)
 {
-	struct usb_interface *intf = to_usb_interface(dev->parent);
-	struct usb_device *usb_dev = interface_to_usbdev(intf);
-
-	char *device_type;
+	switch (type) {
+	case RAZER_CMD_BRIGHTNESS:
+		return razer_set_brightness(razer_dev, cmd->args[0]);
 
-	switch (usb_dev->descriptor.idProduct) {
-	case USB_DEVICE_ID_RAZER_BLADE_STEALTH_2016:
-		device_type = "Razer Blade Stealth 2016\n";
-		break;
+	case RAZER_CMD_LOGO:
+		return razer_set_logo(razer_dev, cmd->args[0]);
 
-	case USB_DEVICE_ID_RAZER_BLADE_14_2016:
-		device_type = "Razer Blade 14 2016\n";
-		break;
+	case RAZER_CMD_FN_MODE:
+		return razer_set_fn_mode(razer_dev, cmd->args[0]);
 
-	case USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA:
-		device_type = "Razer BlackWidow Chroma\n";
-		break;
+	case RAZER_CMD_EFFECT:
+		return razer_run_effect(razer_dev, cmd);
 
 	default:
-		device_type = "Unknown Device\n";
+		return -EINVAL;
 	}
-
-	return sprintf(buf, device_type);
 }
 
-/*
- * Read device file "brightness"
- * Returns the brightness value from 0-255.
- */
-static ssize_t razer_attr_read_brightness(struct device *dev,
-					  struct device_attribute *attr,
-					  char *buf)
+// Remove the oldest queued command of the types in mask.
+// Returns false if there is none.
+static bool razer_queue_pop(struct razer_cmd_queue *queue, unsigned long mask,
+			    enum razer_cmd_type *type, struct razer_cmd *cmd)
 {
-	struct razer_device *razer_dev  = dev_get_drvdata(dev);
-	int brightness                  = razer_get_brightness(razer_dev);
+	unsigned long flags;
+	unsigned int i;
 
-	return sprintf(buf, "%d\n", brightness);
-}
+	spin_lock_irqsave(&queue->lock, flags);
 
-/*
- * Write device file "brightness"
- * Sets the brightness to the ASCII number written to this file.
- * Values from 0-255.
- */
-static ssize_t razer_attr_write_brightness(struct device *dev,
-					   struct device_attribute *attr,
-					   const char *buf, size_t count)
-{
-	struct razer_device *razer_dev  = dev_get_drvdata(dev);
-	unsigned long temp;
-	int retval;
+	for (i = 0; i < queue->order_len; i++)
+		if (BIT(queue->order[i]) & mask)
+			break;
 
-	retval = kstrtoul(buf, 10, &temp);
-	if (retval != 0) {
-		pr_warn("set brightness requires an ASCII number\n");
-		return retval;
+	if (i == queue->order_len) {
+		spin_unlock_irqrestore(&queue->lock, flags);
+		return false;
 	}
 
-	retval = razer_set_brightness(razer_dev, (unsigned char)temp);
-	if (retval != 0)
-		return retval;
+	*type = queue->order[i];
+	queue->order_len--;
+	memmove(&queue->order[i], &queue->order[i + 1], queue->order_len - i);
+	__clear_bit(*type, &queue->pending);
+	*cmd = queue->cmds[*type];
 
-	return count;
+	spin_unlock_irqrestore(&queue->lock, flags);
+
+	return true;
 }
 
-/*
- * Write device file "set_logo"
- * Sets the logo lighting state to the ASCII number written to this file.
- * 0 = off
- * 1 = on
- */
-static ssize_t razer_attr_write_set_logo(struct device *dev,
-					 struct device_attribute *attr,
-					 const char *buf, size_t count)
+// Execute the queued commands of the types in mask in queue order.
+// Must be called from the device workqueue, which is the only dispatcher.
+void razer_queue_run(struct razer_cmd_queue *queue, unsigned long mask)
 {
-	struct razer_device *razer_dev  = dev_get_drvdata(dev);
-	unsigned long temp;
+	struct razer_data *data = queue->razer_dev->data;
+	enum razer_cmd_type type;
+	struct razer_cmd cmd;
 	int retval;
 
-	retval = kstrtoul(buf, 10, &temp);
-	if (retval != 0) {
-		pr_warn("set_logo: requires an ASCII number\n");
-		return retval;
+	while (razer_queue_pop(queue, mask, &type, &cmd)) {
+		retval = razer_run_cmd(queue->razer_dev, type, &cmd);
+		if (retval != 0)
+			razer_queue_set_error(data, retval);
 	}
+}
 
-	retval = razer_set_logo(razer_dev, (unsigned char)temp);
-	if (retval != 0)
-		return retval;
+// Returns true if interactive commands wait for a frame upload.
+// Runs with the device lock held and reads the pending bitmap without the
+// queue lock. A stale value only delays a command to the next row.
+bool razer_queue_preempt(struct razer_device *razer_dev, void *context)
+{
+	struct razer_data *data = razer_dev->data;
 
-	return count;
+	return (READ_ONCE(data->queue.pending) & RAZER_CMD_INTERACTIVE) != 0;
 }
 
-/*
- * Write device file "fn_mode"
- * Sets the FN mode to the ASCII number written to this file.
- * If 0 the F-keys work as normal F-keys
- * If 1 the F-keys act as if the FN key is held
- */
-static ssize_t razer_attr_write_fn_mode(struct device *dev,
-					struct device_attribute *attr,
-					const char *buf, size_t count)
+static void razer_cmd_work(struct work_struct *work)
 {
-	struct razer_device *razer_dev = dev_get_drvdata(dev);
-	unsigned long temp;
-	int retval;
+	struct razer_cmd_queue *queue =
+		container_of(work, struct razer_cmd_queue, work);
 
-	retval = kstrtoul(buf, 10, &temp);
-	if (retval != 0) {
-		pr_warn("set fn_mode requires an ASCII number\n");
-		return retval;
+	razer_queue_run(queue, ~0UL);
+}
+
+// Queue a command and return at once.
+// A pending command of the same type is replaced.
+int razer_queue_cmd(struct razer_device *razer_dev, enum razer_cmd_type type,
+		    enum razer_effect effect, const unsigned char *args,
+		    size_t len)
+{
+	struct razer_data *data         = razer_dev->data;
+	struct razer_cmd_queue *queue   = &data->queue;
+	unsigned long flags;
+
+	if (len > RAZER_CMD_ARGS_MAX)
+		return -EINVAL;
+
+	// A hardware effect replaces the software effect and the animation.
+	if (type == RAZER_CMD_EFFECT) {
+		razer_fx_stop(&data->fx);
+		razer_anim_stop(&data->anim);
 	}
 
-	retval = razer_set_fn_mode(razer_dev, (unsigned char)temp);
-	if (retval != 0)
-		return retval;
+	spin_lock_irqsave(&queue->lock, flags);
 
-	return count;
+	if (!__test_and_set_bit(type, &queue->pending))
+		queue->order[queue->order_len++] = type;
+
+	queue->cmds[type].effect = effect;
+	queue->cmds[type].len    = len;
+	memcpy(queue->cmds[type].args, args, len);
+
+	queue_work(data->wq, &queue->work);
+
+	spin_unlock_irqrestore(&queue->lock, flags);
+
+	return 0;
 }
 
-/*
- * Read device file "fn_mode"
- * Returns the current fn mode state.
- */
-static ssize_t razer_attr_read_fn_mode(struct device *dev,
-				       struct device_attribute *attr, char *buf)
+static void razer_call_work(struct work_struct *work)
 {
-	struct razer_device *razer_dev  = dev_get_drvdata(dev);
-	struct razer_data *data         = razer_dev->data;
+	struct razer_call *call = container_of(work, struct razer_call, work);
+	struct razer_data *data = call->razer_dev->data;
 
-	return sprintf(buf, "%d\n", data->fn_mode_state);
+	// Interactive commands don't wait behind the call.
+	razer_queue_run(&data->queue, RAZER_CMD_INTERACTIVE);
+
+	call->retval = call->fn(call->razer_dev, call->arg);
+	complete(&call->done);
+}
+
+// Run fn on the device workqueue and wait for its result.
+// The workqueue stays the only dispatcher of USB I/O, so fn runs after all
+// work queued before. Must not be called from the device workqueue.
+int razer_queue_call(struct razer_device *razer_dev,
+		     int (*fn)(struct razer_device *razer_dev, void *arg),
+		     void *arg)
+{
+	struct razer_data *data = razer_dev->data;
+	struct razer_call call  = {
+		.razer_dev = razer_dev,
+		.fn        = fn,
+		.arg       = arg,
+	};
+
+	INIT_WORK_ONSTACK(&call.work, razer_call_work);
+	init_completion(&call.done);
+
+	queue_work(data->wq, &call.work);
+	wait_for_completion(&call.done);
+	destroy_work_on_stack(&call.work);
+
+	return call.retval;
+}
+
+// Check the response of the last deferred request.
+static int razer_call_settle(struct razer_device *razer_dev, void *arg)
+{
+	razer_settle(razer_dev);
+
+	return 0;
+}
+
+// Wait until all queued commands and frames have been sent.
+// Returns and clears the first error since the last flush.
+int razer_queue_flush(struct razer_device *razer_dev)
+{
+	struct razer_data *data = razer_dev->data;
+	unsigned long flags;
+	int error;
+
+	// Send a scheduled frame now instead of waiting for its tick.
+	flush_delayed_work(&data->sched.work);
+
+	// The workqueue is ordered, so the call runs after all queued work.
+	razer_queue_call(razer_dev, razer_call_settle, NULL);
+
+	spin_lock_irqsave(&data->queue.lock, flags);
+	error = data->queue.error;
+	data->queue.error = 0;
+	spin_unlock_irqrestore(&data->queue.lock, flags);
+
+	return error;
+}
+
+// Initialize the command queue.
+void razer_queue_init(struct razer_cmd_queue *queue)
+{
+	spin_lock_init(&queue->lock);
+	INIT_WORK(&queue->work, razer_cmd_work);
+}
+
+//#######################//
+//### Frame Scheduler ###//
+//#######################//
+
+// Upload a custom frame and show it.
+// The device shows an uploaded frame only once custom mode is set, so it
+// is set after every upload. With deferred responses, the last row is
+// checked before custom mode is sent. A rejected row makes the next frame
+// a full upload.
+int razer_commit_frame(struct razer_device *razer_dev,
+		       unsigned char *frame, size_t frame_len)
+{
+	int retval;
+
+	retval = razer_set_key_colors(razer_dev, frame, frame_len);
+	if (retval != 0)
+		return retval;
+
+	return razer_set_custom_mode(razer_dev);
+}
+
+// Returns the jiffies to wait until the next frame may be committed.
+// Must be called with the scheduler lock held.
+static unsigned long razer_frame_delay(struct razer_frame_sched *sched)
+{
+	unsigned long next;
+
+	if (sched->rate == 0)
+		return 0;
+
+	next = sched->last_commit +
+	       max_t(unsigned long, 1, msecs_to_jiffies(1000 / sched->rate));
+
+	return time_after(next, jiffies) ? next - jiffies : 0;
+}
+
+// Account a committed frame.
+// Must be called with the scheduler lock held.
+static void razer_frame_account(struct razer_frame_sched *sched)
+{
+	unsigned long now = jiffies;
+
+	sched->committed++;
+	sched->window_frames++;
+
+	if (time_after_eq(now, sched->window_start + HZ)) {
+		sched->fps = sched->window_frames * HZ /
+			     (now - sched->window_start);
+		sched->window_frames = 0;
+		sched->window_start  = now;
+	}
+}
+
+static void razer_frame_sched_work(struct work_struct *work)
+{
+	struct razer_frame_sched *sched =
+		container_of(to_delayed_work(work), struct razer_frame_sched,
+			     work);
+	unsigned long flags;
+	int retval;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	if (!sched->has_pending || sched->stopped) {
+		spin_unlock_irqrestore(&sched->lock, flags);
+		return;
+	}
+	memcpy(sched->frame, sched->pending, sched->size);
+	sched->has_pending = false;
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	retval = razer_commit_frame(sched->razer_dev, sched->frame,
+				    sched->size);
+	if (retval != 0)
+		razer_queue_set_error(sched->razer_dev->data, retval);
+
+	spin_lock_irqsave(&sched->lock, flags);
+	sched->last_commit = jiffies;
+	if (retval == 0)
+		razer_frame_account(sched);
+
+	// Keep ticking while new frames arrive.
+	if (sched->has_pending && !sched->stopped)
+		queue_delayed_work(sched->wq, &sched->work,
+				   razer_frame_delay(sched));
+	spin_unlock_irqrestore(&sched->lock, flags);
+}
+
+// Submit a custom frame and return at once. Takes in an array of RGB bytes.
+// The frame replaces any pending frame and is committed on the next tick,
+// or as soon as possible without a frame rate.
+int razer_frame_submit(struct razer_device *razer_dev,
+		       unsigned char *frame, size_t frame_len)
+{
+	struct razer_data *data         = razer_dev->data;
+	struct razer_frame_sched *sched = &data->sched;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sched->lock, flags);
+
+	if (sched->stopped) {
+		spin_unlock_irqrestore(&sched->lock, flags);
+		return -ENODEV;
+	}
+
+	if (!sched->pending) {
+		spin_unlock_irqrestore(&sched->lock, flags);
+		pr_warn("frame_submit: unsupported device\n");
+		return -EINVAL;
+	}
+
+	if (frame_len != sched->size) {
+		spin_unlock_irqrestore(&sched->lock, flags);
+		pr_warn("frame_submit: wrong amount of RGB data provided: "
+			"%lu of %lu\n", frame_len, sched->size);
+		return -EINVAL;
+	}
+
+	// The previous frame was superseded before it was committed.
+	if (sched->has_pending)
+		sched->dropped++;
+
+	memcpy(sched->pending, frame, frame_len);
+	sched->has_pending = true;
+
+	queue_delayed_work(sched->wq, &sched->work, razer_frame_delay(sched));
+
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	return 0;
+}
+
+// Set the frame rate of the scheduler.
+// 0 commits frames as soon as possible.
+int razer_frame_set_rate(struct razer_device *razer_dev, unsigned int rate)
+{
+	struct razer_data *data         = razer_dev->data;
+	struct razer_frame_sched *sched = &data->sched;
+	unsigned long flags;
+
+	if (rate > RAZER_FRAME_RATE_MAX) {
+		pr_warn("frame_rate: must be within 0-%d: got: %u\n",
+			RAZER_FRAME_RATE_MAX, rate);
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&sched->lock, flags);
+	sched->rate = rate;
+	if (sched->has_pending)
+		mod_delayed_work(sched->wq, &sched->work,
+				 razer_frame_delay(sched));
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	return 0;
+}
+
+// Initialize the frame scheduler.
+void razer_frame_sched_init(struct razer_frame_sched *sched)
+{
+	spin_lock_init(&sched->lock);
+	INIT_DELAYED_WORK(&sched->work, razer_frame_sched_work);
+
+	sched->window_start = jiffies;
+	sched->last_commit  = jiffies;
+}
+
+// Allocate the frame buffers of the scheduler for frames of the given size.
+// A size of 0 disables scheduling.
+int razer_frame_sched_setup(struct razer_frame_sched *sched,
+			    struct razer_device *razer_dev,
+			    struct workqueue_struct *wq, size_t size)
+{
+	sched->razer_dev = razer_dev;
+	sched->wq        = wq;
+	sched->size      = size;
+
+	if (size == 0)
+		return 0;
+
+	sched->pending = kzalloc(size, GFP_KERNEL);
+	sched->frame   = kzalloc(size, GFP_KERNEL);
+	if (!sched->pending || !sched->frame) {
+		kfree(sched->pending);
+		kfree(sched->frame);
+		sched->pending = NULL;
+		sched->frame   = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+// Stop the frame scheduler and release its buffers.
+void razer_frame_sched_destroy(struct razer_frame_sched *sched)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	sched->stopped = true;
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	cancel_delayed_work_sync(&sched->work);
+
+	kfree(sched->pending);
+	kfree(sched->frame);
+	sched->pending = NULL;
+	sched->frame   = NULL;
+}
+
+//#####################//
+//### Effect Engine ###//
+//#####################//
+
+// Built-in font for scrolling text. Each row holds RAZER_FONT_WIDTH bits,
+// bit 2 is the left column. Characters not listed render blank.
+static const unsigned char razer_font[128][RAZER_FONT_HEIGHT] = {
+	['0'] = { 7, 5, 5, 5, 7 }, ['1'] = { 2, 6, 2, 2, 7 },
+	['2'] = { 7, 1, 7, 4, 7 }, ['3'] = { 7, 1, 7, 1, 7 },
+	['4'] = { 5, 5, 7, 1, 1 }, ['5'] = { 7, 4, 7, 1, 7 },
+	['6'] = { 7, 4, 7, 5, 7 }, ['7'] = { 7, 1, 1, 2, 2 },
+	['8'] = { 7, 5, 7, 5, 7 }, ['9'] = { 7, 5, 7, 1, 7 },
+	['A'] = { 2, 5, 7, 5, 5 }, ['B'] = { 6, 5, 6, 5, 6 },
+	['C'] = { 3, 4, 4, 4, 3 }, ['D'] = { 6, 5, 5, 5, 6 },
+	['E'] = { 7, 4, 6, 4, 7 }, ['F'] = { 7, 4, 6, 4, 4 },
+	['G'] = { 3, 4, 5, 5, 3 }, ['H'] = { 5, 5, 7, 5, 5 },
+	['I'] = { 7, 2, 2, 2, 7 }, ['J'] = { 1, 1, 1, 5, 2 },
+	['K'] = { 5, 5, 6, 5, 5 }, ['L'] = { 4, 4, 4, 4, 7 },
+	['M'] = { 5, 7, 7, 5, 5 }, ['N'] = { 6, 5, 5, 5, 5 },
+	['O'] = { 2, 5, 5, 5, 2 }, ['P'] = { 6, 5, 6, 4, 4 },
+	['Q'] = { 2, 5, 5, 6, 3 }, ['R'] = { 6, 5, 6, 5, 5 },
+	['S'] = { 3, 4, 2, 1, 6 }, ['T'] = { 7, 2, 2, 2, 2 },
+	['U'] = { 5, 5, 5, 5, 7 }, ['V'] = { 5, 5, 5, 5, 2 },
+	['W'] = { 5, 5, 7, 7, 5 }, ['X'] = { 5, 5, 2, 5, 5 },
+	['Y'] = { 5, 5, 2, 2, 2 }, ['Z'] = { 7, 1, 2, 4, 7 },
+	['!'] = { 2, 2, 2, 0, 2 }, ['?'] = { 6, 1, 2, 0, 2 },
+	['.'] = { 0, 0, 0, 0, 2 }, [':'] = { 0, 2, 0, 2, 0 },
+	['-'] = { 0, 0, 7, 0, 0 }, ['+'] = { 0, 2, 7, 2, 0 },
+};
+
+static const char * const razer_fx_names[RAZER_FX_COUNT] = {
+	[RAZER_FX_NONE]     = "none",
+	[RAZER_FX_GRADIENT] = "gradient",
+	[RAZER_FX_PULSE]    = "pulse",
+	[RAZER_FX_SCROLL]   = "scroll",
+	[RAZER_FX_WAVE]     = "wave",
+	[RAZER_FX_RIPPLE]   = "ripple",
+	[RAZER_FX_FADE]     = "fade",
+};
+
+// Returns a triangle wave of 0-255 over a phase of 0-0xFFFF.
+static unsigned int razer_fx_triangle(unsigned int phase)
+{
+	phase &= 0xFFFF;
+
+	return (phase < 0x8000 ? phase : 0xFFFF - phase) >> 7;
+}
+
+// Returns the phase 0-0xFFFF of a cycle ms milliseconds after its start.
+static unsigned int razer_fx_phase(unsigned int ms, unsigned int period_ms)
+{
+	if (period_ms == 0)
+		return 0;
+
+	// Fits 32 bits, since period_ms is at most RAZER_FX_PERIOD_MAX_MS.
+	return (ms % period_ms) * 0x10000 / period_ms;
+}
+
+// Write the mix of two colors to an RGB pixel.
+// level 255 gives fg, 0 gives bg.
+static void razer_fx_mix(unsigned char *pixel, const struct razer_rgb *fg,
+			 const struct razer_rgb *bg, unsigned int level)
+{
+	pixel[0] = (fg->r * level + bg->r * (255 - level)) / 255;
+	pixel[1] = (fg->g * level + bg->g * (255 - level)) / 255;
+	pixel[2] = (fg->b * level + bg->b * (255 - level)) / 255;
+}
+
+// Returns the level of a key lit by a ring spreading out of a center key.
+// The ring is two keys wide and fades out while it spreads.
+// Distances are in 1/16 keys.
+static unsigned int razer_fx_pulse(const struct razer_fx_engine *engine,
+				   unsigned int row, unsigned int column,
+				   unsigned int center_row,
+				   unsigned int center_column,
+				   unsigned int phase)
+{
+	const unsigned int width = 2 * 16;
+	int dr = (int)row - (int)center_row;
+	int dc = (int)column - (int)center_column;
+	unsigned int dist, max_dist, radius, gap;
+
+	dist     = int_sqrt((dr * dr + dc * dc) * 256);
+	max_dist = int_sqrt((engine->rows * engine->rows +
+			     engine->columns * engine->columns) * 256);
+	radius   = (phase * max_dist) >> 16;
+	gap      = abs((int)dist - (int)radius);
+
+	if (gap >= width)
+		return 0;
+
+	return ((width - gap) * 255 / width * (0x10000 - phase)) >> 16;
+}
+
+// Returns whether a key shows a set bit of the scrolling bitmap.
+// The bitmap enters at the right and moves one column per period.
+static bool razer_fx_scroll(const struct razer_fx_engine *engine,
+			    unsigned int row, unsigned int column,
+			    unsigned int ms)
+{
+	const struct razer_fx *fx = &engine->fx;
+	unsigned int x;
+
+	x = ms / fx->period_ms % (fx->bitmap_len + engine->columns) + column;
+	if (x < engine->columns || x >= engine->columns + fx->bitmap_len)
+		return false;
+
+	return fx->bitmap[x - engine->columns] & BIT(row);
+}
+
+// Returns the level of a key for the reactive effects.
+// Each press either spreads a ring (ripple) or lights its key (fade) for
+// period_ms. Older presses are skipped, razer_fx_snapshot clears them.
+static unsigned int razer_fx_react(const struct razer_fx_engine *engine,
+				   const struct razer_fx_press *presses,
+				   unsigned int row, unsigned int column)
+{
+	const struct razer_fx *fx = &engine->fx;
+	unsigned int i, age, phase, level = 0;
+
+	for (i = 0; i < RAZER_FX_PRESSES; i++) {
+		if (!presses[i].used)
+			continue;
+
+		age = jiffies_to_msecs(jiffies - presses[i].time);
+		if (age >= fx->period_ms)
+			continue;
+
+		phase = razer_fx_phase(age, fx->period_ms);
+
+		if (fx->type == RAZER_FX_RIPPLE)
+			level = max(level, razer_fx_pulse(engine, row, column,
+							  presses[i].row,
+							  presses[i].column,
+							  phase));
+		else if (presses[i].row == row && presses[i].column == column)
+			level = max(level, (0xFFFF - phase) >> 8);
+	}
+
+	return level;
+}
+
+// Render the effect ms milliseconds after its start into the canvas.
+// presses is a snapshot of the key presses for the reactive effects.
+// Must be called with the engine lock held.
+static void razer_fx_render(struct razer_fx_engine *engine,
+			    const struct razer_fx_press *presses,
+			    unsigned int ms)
+{
+	const struct razer_fx *fx = &engine->fx;
+	unsigned int phase        = razer_fx_phase(ms, fx->period_ms);
+	unsigned int last_column  = max(engine->columns - 1, 1U);
+	unsigned char *pixel      = engine->canvas;
+	unsigned int row, column, level;
+
+	for (row = 0; row < engine->rows; row++) {
+		for (column = 0; column < engine->columns; column++) {
+			switch (fx->type) {
+			case RAZER_FX_GRADIENT:
+				level = 255 - razer_fx_triangle(phase +
+					column * 0x8000 / last_column);
+				break;
+
+			case RAZER_FX_PULSE:
+				level = razer_fx_pulse(engine, row, column,
+						       fx->row, fx->column,
+						       phase);
+				break;
+
+			case RAZER_FX_RIPPLE:
+			case RAZER_FX_FADE:
+				level = razer_fx_react(engine, presses, row,
+						       column);
+				break;
+
+			case RAZER_FX_SCROLL:
+				level = razer_fx_scroll(engine, row, column,
+							ms) ? 255 : 0;
+				break;
+
+			case RAZER_FX_WAVE:
+				// Every row runs the wave shifted in phase.
+				level = razer_fx_triangle(phase +
+					row * 0x10000 / engine->rows -
+					column * 0x10000 / engine->columns);
+				break;
+
+			default:
+				level = 0;
+				break;
+			}
+
+			razer_fx_mix(pixel, &fx->fg, &fx->bg, level);
+			pixel += 3;
+		}
+	}
+}
+
+// Render text with the built-in font into scroll columns.
+// top is the keyboard row of the first glyph row.
+// Returns the amount of columns.
+static unsigned int razer_fx_text(unsigned char *bitmap, const char *text,
+				  size_t len, unsigned int top)
+{
+	const unsigned char *glyph;
+	unsigned int i, x, y, n = 0;
+
+	for (i = 0; i < len; i++) {
+		glyph = razer_font[toupper(text[i]) & 0x7F];
+
+		for (x = 0; x < RAZER_FONT_WIDTH; x++, n++) {
+			bitmap[n] = 0;
+			for (y = 0; y < RAZER_FONT_HEIGHT; y++)
+				if (glyph[y] & BIT(RAZER_FONT_WIDTH - 1 - x))
+					bitmap[n] |= BIT(top + y);
+		}
+
+		bitmap[n++] = 0;  // Gap between the characters.
+	}
+
+	return n;
+}
+
+// Mark presses whose reaction faded out as unused and copy the presses.
+// Must be called with the engine lock held.
+static void razer_fx_snapshot(struct razer_fx_engine *engine,
+			      struct razer_fx_press *presses)
+{
+	struct razer_fx_press *press;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&engine->press_lock, flags);
+
+	for (i = 0; i < RAZER_FX_PRESSES; i++) {
+		press = &engine->presses[i];
+		if (press->used && jiffies_to_msecs(jiffies - press->time) >=
+				   engine->fx.period_ms)
+			press->used = false;
+	}
+
+	memcpy(presses, engine->presses, sizeof(engine->presses));
+
+	spin_unlock_irqrestore(&engine->press_lock, flags);
+}
+
+static void razer_fx_work(struct work_struct *work)
+{
+	struct razer_fx_engine *engine =
+		container_of(to_delayed_work(work), struct razer_fx_engine,
+			     work);
+	struct razer_data *data = engine->razer_dev->data;
+	struct razer_fx_press presses[RAZER_FX_PRESSES];
+	unsigned int rate, i;
+	bool active = false;
+	int retval;
+
+	mutex_lock(&engine->lock);
+
+	if (engine->fx.type == RAZER_FX_NONE || engine->stopped)
+		goto exit_unlock;
+
+	razer_fx_snapshot(engine, presses);
+
+	razer_fx_render(engine, presses,
+			jiffies_to_msecs(jiffies - engine->start));
+
+	retval = razer_frame_submit(engine->razer_dev, engine->canvas,
+				    engine->rows * engine->columns * 3);
+	if (retval != 0) {
+		razer_queue_set_error(data, retval);
+		engine->fx.type = RAZER_FX_NONE;
+		goto exit_unlock;
+	}
+
+	// A static gradient is rendered once.
+	if (engine->fx.period_ms == 0)
+		goto exit_unlock;
+
+	// Reactive effects idle until the next key press once all reactions
+	// faded out.
+	if (engine->fx.type == RAZER_FX_RIPPLE ||
+	    engine->fx.type == RAZER_FX_FADE) {
+		for (i = 0; i < RAZER_FX_PRESSES; i++)
+			active |= presses[i].used;
+		if (!active)
+			goto exit_unlock;
+	}
+
+	// Render at the scheduler rate, so no rendered frame is dropped.
+	rate = READ_ONCE(data->sched.rate);
+	if (rate == 0)
+		rate = RAZER_FX_DEFAULT_RATE;
+
+	queue_delayed_work(engine->wq, &engine->work,
+			   max_t(unsigned long, 1,
+				 msecs_to_jiffies(1000 / rate)));
+
+exit_unlock:
+	mutex_unlock(&engine->lock);
+}
+
+// Enable or disable recording key presses. Forgets all recorded presses.
+static void razer_fx_set_reactive(struct razer_fx_engine *engine,
+				  bool reactive)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&engine->press_lock, flags);
+	engine->reactive = reactive;
+	memset(engine->presses, 0, sizeof(engine->presses));
+	spin_unlock_irqrestore(&engine->press_lock, flags);
+}
+
+// Record a key press for the reactive effects and render the next frame
+// at once. Called from interrupt context.
+void razer_fx_press(struct razer_fx_engine *engine, unsigned int usage)
+{
+	struct razer_fx_press *press;
+	unsigned long flags;
+	unsigned char pos;
+
+	if (usage >= ARRAY_SIZE(engine->keymap))
+		return;
+
+	pos = engine->keymap[usage];
+	if (pos == RAZER_KEY_NONE)
+		return;
+
+	spin_lock_irqsave(&engine->press_lock, flags);
+
+	if (engine->reactive) {
+		press = &engine->presses[engine->press_next];
+		engine->press_next = (engine->press_next + 1) %
+				     RAZER_FX_PRESSES;
+
+		press->time   = jiffies;
+		press->row    = pos >> 5;
+		press->column = pos & 0x1F;
+		press->used   = true;
+
+		mod_delayed_work(engine->wq, &engine->work, 0);
+	}
+
+	spin_unlock_irqrestore(&engine->press_lock, flags);
+}
+
+// Start a software effect. Replaces the running effect.
+int razer_fx_start(struct razer_fx_engine *engine, const struct razer_fx *fx)
+{
+	mutex_lock(&engine->lock);
+
+	if (engine->stopped || !engine->canvas) {
+		mutex_unlock(&engine->lock);
+		return -ENODEV;
+	}
+
+	engine->fx    = *fx;
+	engine->start = jiffies;
+
+	razer_fx_set_reactive(engine, fx->type == RAZER_FX_RIPPLE ||
+				      fx->type == RAZER_FX_FADE);
+
+	mod_delayed_work(engine->wq, &engine->work, 0);
+
+	mutex_unlock(&engine->lock);
+
+	return 0;
+}
+
+// Stop the running software effect.
+// Called before frames or hardware effects replace it.
+void razer_fx_stop(struct razer_fx_engine *engine)
+{
+	mutex_lock(&engine->lock);
+	engine->fx.type = RAZER_FX_NONE;
+	razer_fx_set_reactive(engine, false);
+	mutex_unlock(&engine->lock);
+
+	cancel_delayed_work_sync(&engine->work);
+}
+
+// Returns the type of the running software effect.
+enum razer_fx_type razer_fx_get_type(struct razer_fx_engine *engine)
+{
+	enum razer_fx_type type;
+
+	mutex_lock(&engine->lock);
+	type = engine->fx.type;
+	mutex_unlock(&engine->lock);
+
+	return type;
+}
+
+// Initialize the effect engine.
+void razer_fx_init(struct razer_fx_engine *engine)
+{
+	mutex_init(&engine->lock);
+	spin_lock_init(&engine->press_lock);
+	INIT_DELAYED_WORK(&engine->work, razer_fx_work);
+	memset(engine->keymap, RAZER_KEY_NONE, sizeof(engine->keymap));
+}
+
+// Allocate the canvas of the effect engine and build the keymap of the
+// model. Models without key colors disable the engine.
+int razer_fx_setup(struct razer_fx_engine *engine,
+		   struct razer_device *razer_dev,
+		   struct workqueue_struct *wq,
+		   const struct razer_model *model)
+{
+	const struct razer_key_pos *key;
+	unsigned int i;
+
+	engine->razer_dev = razer_dev;
+	engine->wq        = wq;
+
+	if (!(model->features & RAZER_FEATURE_KEY_COLORS))
+		return 0;
+
+	engine->rows    = model->rows;
+	engine->columns = model->columns;
+
+	for (i = 0; i < model->keys_len; i++) {
+		key = &model->keys[i];
+		if (key->row < model->rows && key->column < model->columns)
+			engine->keymap[key->usage] = key->row << 5 |
+						     key->column;
+	}
+
+	engine->canvas = kcalloc(engine->rows, engine->columns * 3,
+				 GFP_KERNEL);
+	if (!engine->canvas)
+		return -ENOMEM;
+
+	return 0;
+}
+
+// Stop the effect engine and release its canvas.
+void razer_fx_destroy(struct razer_fx_engine *engine)
+{
+	mutex_lock(&engine->lock);
+	engine->stopped = true;
+	engine->fx.type = RAZER_FX_NONE;
+	mutex_unlock(&engine->lock);
+
+	cancel_delayed_work_sync(&engine->work);
+
+	kfree(engine->canvas);
+	engine->canvas = NULL;
+}
+
+//########################//
+//### Animation Player ###//
+//########################//
+
+static const char * const razer_anim_states[] = {
+	[RAZER_ANIM_STOPPED] = "stopped",
+	[RAZER_ANIM_PLAYING] = "playing",
+	[RAZER_ANIM_PAUSED]  = "paused",
+};
+
+// Ends the frame shown. Runs in hard interrupt context.
+static enum hrtimer_restart razer_anim_timer(struct hrtimer *timer)
+{
+	struct razer_anim_player *player =
+		container_of(timer, struct razer_anim_player, timer);
+
+	WRITE_ONCE(player->expired, true);
+	queue_work(player->wq, &player->work);
+
+	return HRTIMER_NORESTART;
+}
+
+// Returns the duration of the frame at position.
+// Must be called with the player lock held.
+static ktime_t razer_anim_duration(struct razer_anim_player *player)
+{
+	return ms_to_ktime(player->durations[player->position]);
+}
+
+// Submit the frame at position and end it after duration.
+// Must be called with the player lock held.
+static int razer_anim_show(struct razer_anim_player *player,
+			   ktime_t duration)
+{
+	int retval;
+
+	retval = razer_frame_submit(player->razer_dev,
+				    player->frames +
+				    player->position * player->frame_size,
+				    player->frame_size);
+	if (retval != 0)
+		return retval;
+
+	WRITE_ONCE(player->expired, false);
+	hrtimer_start(&player->timer, duration, HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+// Tell pollers of the "animation" file that playback ended.
+static void razer_anim_notify(struct razer_anim_player *player)
+{
+	struct razer_data *data = player->razer_dev->data;
+
+	sysfs_notify(&data->dev->kobj, NULL, "animation");
+}
+
+// Advance to the next frame once the timer ended the frame shown.
+static void razer_anim_work(struct work_struct *work)
+{
+	struct razer_anim_player *player =
+		container_of(work, struct razer_anim_player, work);
+	bool ended = false;
+	int retval;
+
+	mutex_lock(&player->lock);
+
+	if (player->state != RAZER_ANIM_PLAYING || !READ_ONCE(player->expired))
+		goto exit_unlock;
+
+	if (player->position + 1 < player->count) {
+		player->position++;
+	} else if (player->flags & RAZER_ANIM_LOOP) {
+		player->position = 0;
+	} else {
+		// One-shot playback ends after its last frame.
+		player->state    = RAZER_ANIM_STOPPED;
+		player->position = 0;
+		ended = true;
+		goto exit_unlock;
+	}
+
+	retval = razer_anim_show(player, razer_anim_duration(player));
+	if (retval != 0) {
+		razer_queue_set_error(player->razer_dev->data, retval);
+		player->state = RAZER_ANIM_STOPPED;
+		ended = true;
+	}
+
+exit_unlock:
+	mutex_unlock(&player->lock);
+
+	if (ended)
+		razer_anim_notify(player);
+}
+
+// Replace the stored animation and stop the player.
+// buf holds count durations followed by count frames. It is owned by the
+// player on success and freed with vfree.
+int razer_anim_load(struct razer_anim_player *player, void *buf,
+		    unsigned int count, unsigned int flags)
+{
+	u32 *old_durations;
+	bool ended;
+
+	mutex_lock(&player->lock);
+
+	if (player->stopped || player->frame_size == 0) {
+		mutex_unlock(&player->lock);
+		return -ENODEV;
+	}
+
+	hrtimer_cancel(&player->timer);
+
+	ended         = player->state != RAZER_ANIM_STOPPED;
+	old_durations = player->durations;
+
+	player->durations = buf;
+	player->frames    = buf + count * sizeof(*player->durations);
+	player->count     = count;
+	player->flags     = flags;
+	player->position  = 0;
+	player->state     = RAZER_ANIM_STOPPED;
+
+	mutex_unlock(&player->lock);
+
+	vfree(old_durations);
+
+	if (ended)
+		razer_anim_notify(player);
+
+	return 0;
+}
+
+// Play the animation from the frame at position.
+int razer_anim_play(struct razer_anim_player *player)
+{
+	int retval;
+
+	mutex_lock(&player->lock);
+
+	if (!player->durations) {
+		retval = -EINVAL;
+		goto exit_unlock;
+	}
+
+	hrtimer_cancel(&player->timer);
+
+	player->state = RAZER_ANIM_PLAYING;
+
+	retval = razer_anim_show(player, razer_anim_duration(player));
+	if (retval != 0)
+		player->state = RAZER_ANIM_STOPPED;
+
+exit_unlock:
+	mutex_unlock(&player->lock);
+
+	return retval;
+}
+
+// Pause the animation. The frame shown keeps the rest of its duration.
+void razer_anim_pause(struct razer_anim_player *player)
+{
+	mutex_lock(&player->lock);
+
+	if (player->state == RAZER_ANIM_PLAYING) {
+		player->remaining = hrtimer_get_remaining(&player->timer);
+		hrtimer_cancel(&player->timer);
+
+		// The frame ended, but the work has not advanced yet.
+		if (READ_ONCE(player->expired) || player->remaining < 0)
+			player->remaining = 0;
+
+		player->state = RAZER_ANIM_PAUSED;
+	}
+
+	mutex_unlock(&player->lock);
+}
+
+// Resume a paused animation.
+void razer_anim_resume(struct razer_anim_player *player)
+{
+	mutex_lock(&player->lock);
+
+	if (player->state == RAZER_ANIM_PAUSED) {
+		player->state = RAZER_ANIM_PLAYING;
+		hrtimer_start(&player->timer, player->remaining,
+			      HRTIMER_MODE_REL);
+	}
+
+	mutex_unlock(&player->lock);
+}
+
+// Jump to a frame. A playing or paused animation shows it at once with
+// its full duration. It stops if the frame cannot be shown.
+int razer_anim_seek(struct razer_anim_player *player, unsigned int position)
+{
+	bool ended = false;
+	int retval = 0;
+
+	mutex_lock(&player->lock);
+
+	if (position >= player->count) {
+		retval = -EINVAL;
+		goto exit_unlock;
+	}
+
+	player->position = position;
+
+	switch (player->state) {
+	case RAZER_ANIM_PLAYING:
+		hrtimer_cancel(&player->timer);
+		retval = razer_anim_show(player, razer_anim_duration(player));
+		if (retval != 0) {
+			player->state = RAZER_ANIM_STOPPED;
+			ended = true;
+		}
+		break;
+
+	case RAZER_ANIM_PAUSED:
+		retval = razer_frame_submit(player->razer_dev,
+					    player->frames +
+					    position * player->frame_size,
+					    player->frame_size);
+		if (retval != 0) {
+			player->state = RAZER_ANIM_STOPPED;
+			ended = true;
+			break;
+		}
+		player->remaining = razer_anim_duration(player);
+		break;
+
+	default:
+		break;
+	}
+
+exit_unlock:
+	mutex_unlock(&player->lock);
+
+	if (ended)
+		razer_anim_notify(player);
+
+	return retval;
+}
+
+// Stop the animation and rewind it.
+// Called before frames or effects replace it.
+void razer_anim_stop(struct razer_anim_player *player)
+{
+	bool ended;
+
+	mutex_lock(&player->lock);
+
+	hrtimer_cancel(&player->timer);
+
+	ended            = player->state != RAZER_ANIM_STOPPED;
+	player->state    = RAZER_ANIM_STOPPED;
+	player->position = 0;
+
+	mutex_unlock(&player->lock);
+
+	if (ended)
+		razer_anim_notify(player);
+}
+
+// Initialize the animation player.
+void razer_anim_init(struct razer_anim_player *player)
+{
+	mutex_init(&player->lock);
+	hrtimer_setup(&player->timer, razer_anim_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+	INIT_WORK(&player->work, razer_anim_work);
+}
+
+// Set up the animation player for frames of the given size.
+// A size of 0 disables the player.
+void razer_anim_setup(struct razer_anim_player *player,
+		      struct razer_device *razer_dev,
+		      struct workqueue_struct *wq, size_t frame_size)
+{
+	player->razer_dev  = razer_dev;
+	player->wq         = wq;
+	player->frame_size = frame_size;
+}
+
+// Stop the animation player and release the stored animation.
+void razer_anim_destroy(struct razer_anim_player *player)
+{
+	mutex_lock(&player->lock);
+	player->stopped = true;
+	player->state   = RAZER_ANIM_STOPPED;
+	mutex_unlock(&player->lock);
+
+	hrtimer_cancel(&player->timer);
+	cancel_work_sync(&player->work);
+
+	vfree(player->durations);
+	player->durations = NULL;
+	player->frames    = NULL;
+}
+
+//#########################//
+//### Device Attributes ###//
+//#########################//
+
+/*
+ * Read device file "get_serial"
+ * Gets the serial number from the device.
+ * Returns a string.
+ */
+static ssize_t razer_attr_read_get_serial(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
+	ssize_t len;
+
+	mutex_lock(&data->cache_lock);
+	len = sprintf(buf, "%s\n", data->serial);
+	mutex_unlock(&data->cache_lock);
+
+	return len;
+}
+
+/**
+ * Read device file "get_firmware_version"
+ * Gets the firmware version cached at probe time.
+ * Queries the device only if the version is unknown.
+ * Returns a string.
+ */
+static ssize_t
+razer_attr_read_get_firmware_version(struct device *dev,
+				     struct device_attribute *attr,
+				     char *buf)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
+	char fw_string[16]              = "";
+	int retval;
+
+	mutex_lock(&data->cache_lock);
+	strscpy(fw_string, data->fw_version, sizeof(fw_string));
+	mutex_unlock(&data->cache_lock);
+
+	if (fw_string[0] != '\0')
+		return sprintf(buf, "%s\n", fw_string);
+
+	// Query the device outside cache_lock and publish the result.
+	retval = razer_queue_call(razer_dev, razer_call_get_firmware_version,
+				  fw_string);
+	if (retval != 0)
+		return retval;
+
+	mutex_lock(&data->cache_lock);
+	if (data->fw_version[0] == '\0')
+		strscpy(data->fw_version, fw_string, sizeof(data->fw_version));
+	mutex_unlock(&data->cache_lock);
+
+	return sprintf(buf, "%s\n", fw_string);
+}
+
+/*
+ * Read device file "get_key_rows"
+ * Returns the amount of key rows.
+ */
+static ssize_t razer_attr_read_get_key_rows(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int rows                       = razer_get_rows(razer_dev);
+
+	return sprintf(buf, "%d\n", rows);
+}
+
+/*
+ * Read device file "get_key_columns"
+ * Returns the amount of key columns.
+ */
+static ssize_t razer_attr_read_get_key_columns(struct device *dev,
+					       struct device_attribute *attr,
+					       char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int columns                    = razer_get_columns(razer_dev);
+
+	return sprintf(buf, "%d\n", columns);
+}
+
+/**
+ * Read device file "device_type"
+ * Returns a friendly device type string.
+ */
+static ssize_t razer_attr_read_device_type(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_data *data        = razer_dev->data;
+
+	return sprintf(buf, "%s\n", data->model->name);
+}
+
+/*
+ * Read device file "brightness"
+ * Returns the brightness value from 0-255.
+ */
+static ssize_t razer_attr_read_brightness(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
+	int brightness;
+
+	mutex_lock(&data->cache_lock);
+	brightness = data->brightness;
+	mutex_unlock(&data->cache_lock);
+
+	if (brightness >= 0)
+		return sprintf(buf, "%d\n", brightness);
+
+	// Query outside cache_lock. A value cached by a queued write in the
+	// meantime wins.
+	brightness = razer_queue_call(razer_dev, razer_call_get_brightness,
+				      NULL);
+	if (brightness < 0)
+		return brightness;
+
+	mutex_lock(&data->cache_lock);
+	if (data->brightness < 0)
+		data->brightness = brightness;
+	brightness = data->brightness;
+	mutex_unlock(&data->cache_lock);
+
+	return sprintf(buf, "%d\n", brightness);
+}
+
+/*
+ * Write device file "brightness"
+ * Sets the brightness to the ASCII number written to this file.
+ * Values from 0-255.
+ */
+static ssize_t razer_attr_write_brightness(struct device *dev,
+					   struct device_attribute *attr,
+					   const char *buf, size_t count)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	unsigned long temp;
+	unsigned char value;
+	int retval;
+
+	retval = kstrtoul(buf, 10, &temp);
+	if (retval != 0) {
+		pr_warn("set brightness requires an ASCII number\n");
+		return retval;
+	}
+
+	value = (unsigned char)temp;
+
+	// The worker caches the value once the device accepted it.
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_BRIGHTNESS, 0, &value, 1);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "set_logo"
+ * Sets the logo lighting state to the ASCII number written to this file.
+ * 0 = off
+ * 1 = on
+ */
+static ssize_t razer_attr_write_set_logo(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	unsigned long temp;
+	unsigned char value;
+	int retval;
+
+	retval = kstrtoul(buf, 10, &temp);
+	if (retval != 0) {
+		pr_warn("set_logo: requires an ASCII number\n");
+		return retval;
+	}
+
+	value  = (unsigned char)temp;
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_LOGO, 0, &value, 1);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "fn_mode"
+ * Sets the FN mode to the ASCII number written to this file.
+ * If 0 the F-keys work as normal F-keys
+ * If 1 the F-keys act as if the FN key is held
+ */
+static ssize_t razer_attr_write_fn_mode(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	unsigned long temp;
+	unsigned char value;
+	int retval;
+
+	retval = kstrtoul(buf, 10, &temp);
+	if (retval != 0) {
+		pr_warn("set fn_mode requires an ASCII number\n");
+		return retval;
+	}
+
+	value  = (unsigned char)temp;
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_FN_MODE, 0, &value, 1);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Read device file "fn_mode"
+ * Returns the current fn mode state.
+ */
+static ssize_t razer_attr_read_fn_mode(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
+
+	return sprintf(buf, "%d\n", data->fn_mode_state);
+}
+
+/*
+ * Write device file "set_key_colors"
+ * Set the colors of all keys of the keyboard. 3 bytes per color.
+ */
+static ssize_t razer_attr_write_set_key_colors(struct device *dev,
+					       struct device_attribute *attr,
+					       const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_data *data        = razer_dev->data;
+	int retval;
+
+	// Frames of userspace replace the software effect and the animation.
+	razer_fx_stop(&data->fx);
+	razer_anim_stop(&data->anim);
+
+	retval = razer_frame_submit(razer_dev,
+				    (unsigned char *)&buf[0], count);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Read device file "frame_rate"
+ * Returns the frame rate of the frame scheduler.
+ */
+static ssize_t razer_attr_read_frame_rate(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
+
+	return sprintf(buf, "%u\n", READ_ONCE(data->sched.rate));
+}
+
+/*
+ * Write device file "frame_rate"
+ * Sets the frame rate of the frame scheduler to the ASCII number written.
+ * 0 commits every frame immediately.
+ */
+static ssize_t razer_attr_write_frame_rate(struct device *dev,
+					   struct device_attribute *attr,
+					   const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	unsigned int temp;
+	int retval;
+
+	retval = kstrtouint(buf, 10, &temp);
+	if (retval != 0) {
+		pr_warn("frame_rate: requires an ASCII number\n");
+		return retval;
+	}
+
+	retval = razer_frame_set_rate(razer_dev, temp);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Read device file "frame_stats"
+ * Returns the achieved frames per second, the committed frames
+ * and the dropped frames.
+ */
+static ssize_t razer_attr_read_frame_stats(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
+	struct razer_frame_sched *sched = &data->sched;
+	unsigned long flags;
+	unsigned int fps;
+	u64 committed, dropped;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	fps       = sched->fps;
+	committed = sched->committed;
+	dropped   = sched->dropped;
+
+	// No frame within the last window.
+	if (time_after(jiffies, sched->last_commit + HZ))
+		fps = 0;
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	return sprintf(buf, "%u %llu %llu\n", fps,
+		       (unsigned long long)committed,
+		       (unsigned long long)dropped);
+}
+
+/*
+ * Read device file "effect"
+ * Returns the name of the running software effect.
+ */
+static ssize_t razer_attr_read_effect(struct device *dev,
+				      struct device_attribute *attr,
+				      char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_data *data        = razer_dev->data;
+
+	return sprintf(buf, "%s\n",
+		       razer_fx_names[razer_fx_get_type(&data->fx)]);
+}
+
+/*
+ * Write device file "effect"
+ * Start a software effect. Expects the ASCII line:
+ * none
+ * gradient|wave <fg> <bg> <period_ms>
+ * ripple|fade <fg> <bg> <duration_ms>
+ * pulse <fg> <bg> <period_ms> <row> <column>
+ * text <fg> <bg> <step_ms> <text>
+ * bitmap <fg> <bg> <step_ms> <hex columns>
+ * Colors are hex RRGGBB values.
+ */
+static ssize_t razer_attr_write_effect(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_data *data        = razer_dev->data;
+	unsigned int fg, bg, top;
+	struct razer_fx *fx;
+	const char *rest;
+	char name[16];
+	size_t len;
+	int retval, n = 0;
+
+	if (sscanf(buf, "%15s", name) == 1 && strcmp(name, "none") == 0) {
+		razer_fx_stop(&data->fx);
+		return count;
+	}
+
+	fx = kzalloc(sizeof(*fx), GFP_KERNEL);
+	if (!fx)
+		return -ENOMEM;
+
+	retval = -EINVAL;
+
+	if (sscanf(buf, "%15s %x %x %u %n", name, &fg, &bg, &fx->period_ms,
+		   &n) != 4 || fg > 0xFFFFFF || bg > 0xFFFFFF ||
+	    fx->period_ms > RAZER_FX_PERIOD_MAX_MS) {
+		pr_warn("effect: requires name fg bg period_ms ...\n");
+		goto exit_free;
+	}
+
+	fx->fg.r = fg >> 16;
+	fx->fg.g = fg >> 8;
+	fx->fg.b = fg;
+	fx->bg.r = bg >> 16;
+	fx->bg.g = bg >> 8;
+	fx->bg.b = bg;
+
+	rest = buf + n;
+	len  = strcspn(rest, "\n");
+
+	if (strcmp(name, "gradient") == 0) {
+		fx->type = RAZER_FX_GRADIENT;
+	} else if (strcmp(name, "wave") == 0) {
+		fx->type = RAZER_FX_WAVE;
+	} else if (strcmp(name, "ripple") == 0) {
+		fx->type = RAZER_FX_RIPPLE;
+	} else if (strcmp(name, "fade") == 0) {
+		fx->type = RAZER_FX_FADE;
+	} else if (strcmp(name, "pulse") == 0) {
+		fx->type = RAZER_FX_PULSE;
+		if (sscanf(rest, "%u %u", &fx->row, &fx->column) != 2 ||
+		    fx->row >= data->fx.rows ||
+		    fx->column >= data->fx.columns) {
+			pr_warn("effect: pulse requires a row and column\n");
+			goto exit_free;
+		}
+	} else if (strcmp(name, "text") == 0) {
+		fx->type = RAZER_FX_SCROLL;
+		if (len == 0 || len > RAZER_FX_TEXT_MAX) {
+			pr_warn("effect: text requires 1-%d characters\n",
+				RAZER_FX_TEXT_MAX);
+			goto exit_free;
+		}
+
+		// Center the glyphs vertically.
+		top = data->fx.rows > RAZER_FONT_HEIGHT ?
+		      (data->fx.rows - RAZER_FONT_HEIGHT + 1) / 2 : 0;
+		fx->bitmap_len = razer_fx_text(fx->bitmap, rest, len, top);
+	} else if (strcmp(name, "bitmap") == 0) {
+		fx->type = RAZER_FX_SCROLL;
+		if (len == 0 || len % 2 != 0 ||
+		    len / 2 > RAZER_FX_BITMAP_MAX ||
+		    hex2bin(fx->bitmap, rest, len / 2) != 0) {
+			pr_warn("effect: bitmap requires 1-%d hex columns\n",
+				RAZER_FX_BITMAP_MAX);
+			goto exit_free;
+		}
+		fx->bitmap_len = len / 2;
+	} else {
+		pr_warn("effect: unknown effect: %s\n", name);
+		goto exit_free;
+	}
+
+	// Only a gradient may stand still.
+	if (fx->period_ms == 0 && fx->type != RAZER_FX_GRADIENT) {
+		pr_warn("effect: %s requires a period_ms\n", name);
+		goto exit_free;
+	}
+
+	razer_anim_stop(&data->anim);
+
+	retval = razer_fx_start(&data->fx, fx);
+	if (retval == 0)
+		retval = count;
+
+exit_free:
+	kfree(fx);
+	return retval;
+}
+
+/*
+ * Read device file "animation"
+ * Returns the player state, the frame position and the amount of frames.
+ */
+static ssize_t razer_attr_read_animation(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	struct razer_device *razer_dev   = dev_get_drvdata(dev);
+	struct razer_data *data          = razer_dev->data;
+	struct razer_anim_player *player = &data->anim;
+	ssize_t len;
+
+	mutex_lock(&player->lock);
+	len = sprintf(buf, "%s %u %u\n", razer_anim_states[player->state],
+		      player->position, player->count);
+	mutex_unlock(&player->lock);
+
+	return len;
+}
+
+/*
+ * Write device file "animation"
+ * Controls the player. Expects one of the ASCII commands:
+ * play, pause, resume, stop, seek <frame>
+ */
+static ssize_t razer_attr_write_animation(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_data *data        = razer_dev->data;
+	unsigned int position;
+	char name[16];
+	int retval = 0;
+
+	if (sscanf(buf, "%15s", name) != 1) {
+		pr_warn("animation: requires a command\n");
+		return -EINVAL;
+	}
+
+	if (strcmp(name, "play") == 0) {
+		// The animation replaces the software effect.
+		razer_fx_stop(&data->fx);
+		retval = razer_anim_play(&data->anim);
+	} else if (strcmp(name, "pause") == 0) {
+		razer_anim_pause(&data->anim);
+	} else if (strcmp(name, "resume") == 0) {
+		razer_anim_resume(&data->anim);
+	} else if (strcmp(name, "stop") == 0) {
+		razer_anim_stop(&data->anim);
+	} else if (strcmp(name, "seek") == 0) {
+		if (sscanf(buf, "%15s %u", name, &position) != 2) {
+			pr_warn("animation: seek requires a frame\n");
+			return -EINVAL;
+		}
+		retval = razer_anim_seek(&data->anim, position);
+	} else {
+		pr_warn("animation: unknown command: %s\n", name);
+		return -EINVAL;
+	}
+
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "refresh"
+ * Queries the firmware version, serial and brightness again.
+ */
+static ssize_t razer_attr_write_refresh(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	retval = razer_queue_call(razer_dev, razer_call_refresh_cache, NULL);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "flush"
+ * Waits until all queued commands and frames have been sent to the device.
+ * Fails with the first error since the last flush.
+ */
+static ssize_t razer_attr_write_flush(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	retval = razer_queue_flush(razer_dev);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Read device file "ready"
+ * Returns 1 once the device states have been restored, else 0.
+ */
+static ssize_t razer_attr_read_ready(struct device *dev,
+				     struct device_attribute *attr,
+				     char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_data *data        = razer_dev->data;
+
+	return sprintf(buf, "%d\n", READ_ONCE(data->ready) ? 1 : 0);
+}
+
+/*
+ * Write device file "mode_none"
+ * Disable keyboard effects / turns the keyboard LEDs off.
+ */
+static ssize_t razer_attr_write_mode_none(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_EFFECT,
+				 RAZER_EFFECT_NONE, NULL, 0);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "mode_static"
+ * Set the keyboard to static mode when 3 RGB bytes are written.
+ */
+static ssize_t razer_attr_write_mode_static(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	if (count != 3) {
+		pr_warn("mode static requires 3 RGB bytes\n");
+		return -EINVAL;
+	}
+
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_EFFECT,
+				 RAZER_EFFECT_STATIC, (const unsigned char *)buf,
+				 count);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "mode_custom"
+ * Sets the keyboard to custom mode whenever the file is written to.
+ */
+static ssize_t razer_attr_write_mode_custom(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_EFFECT,
+				 RAZER_EFFECT_CUSTOM, NULL, 0);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "mode_wave"
+ * If the ASCII number 1 is written then the wave effect is displayed
+ * moving left across the keyboard.
+ * If the ASCII number 2 is written then the wave effect goes right.
+ */
+static ssize_t razer_attr_write_mode_wave(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	unsigned long temp;
+	unsigned char value;
+	int retval;
+
+	retval = kstrtoul(buf, 10, &temp);
+	if (retval != 0) {
+		pr_warn("mode_wave: requires an ASCII number\n");
+		return retval;
+	}
+
+	value  = (unsigned char)temp;
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_EFFECT,
+				 RAZER_EFFECT_WAVE, &value, 1);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "mode_spectrum"
+ * Specrum effect mode is activated whenever the file is written to.
+ */
+static ssize_t razer_attr_write_mode_spectrum(struct device *dev,
+					      struct device_attribute *attr,
+					      const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_EFFECT,
+				 RAZER_EFFECT_SPECTRUM, NULL, 0);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "mode_reactive"
+ * Sets reactive mode when this file is written to.
+ * A speed byte and 3 RGB bytes should be written.
+ * The speed must be within 1-3
+ * 1 Short, 2 Medium, 3 Long
+ */
+static ssize_t razer_attr_write_mode_reactive(struct device *dev,
+					      struct device_attribute *attr,
+					      const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	if (count != 4) {
+		pr_warn("mode reactive requires one speed byte followed by 3 RGB bytes\n");
+		return -EINVAL;
+	}
+
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_EFFECT,
+				 RAZER_EFFECT_REACTIVE,
+				 (const unsigned char *)buf, count);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Write device file "mode_starlight"
+ * Requires at least one byte representing the effect speed.
+ * The speed must be within 1-3
+ * 1 Short, 2 Medium, 3 Long
+ *
+ * Starlight mode has 3 modes of operation:
+ *   Mode 1: single color. 3 RGB bytes.
+ *   Mode 2: two colors. 6 RGB bytes.
+ *   Mode 3: random colors. Anything else passed.
+ */
+static ssize_t razer_attr_write_mode_starlight(struct device *dev,
+					       struct device_attribute *attr,
+					       const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	if (count < 1) {
+		pr_warn("mode starlight requires one speed byte\n");
+		return -EINVAL;
+	}
+
+	// Single color mode: 4 bytes, dual color mode: 7 bytes.
+	// Random color mode otherwise.
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_EFFECT,
+				 RAZER_EFFECT_STARLIGHT,
+				 (const unsigned char *)buf,
+				 (count == 4 || count == 7) ? count : 1);
+	if (retval != 0)
+		return retval;
+
+	return count;
 }
 
 /*
- * Write device file "set_key_colors"
- * Set the colors of all keys of the keyboard. 3 bytes per color.
+ * Write device file "mode_breath"
+ * Breathing mode has 3 modes of operation.
+ * Mode 1 fading in and out using a single color. 3 RGB bytes.
+ * Mode 2 is fading in and out between two colors. 6 RGB bytes.
+ * Mode 3 is fading in and out between random colors. Anything else passed.
  */
-static ssize_t razer_attr_write_set_key_colors(struct device *dev,
+static ssize_t razer_attr_write_mode_breath(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	int retval;
+
+	// Single color mode: 3 bytes, dual color mode: 6 bytes.
+	// Random color mode otherwise.
+	retval = razer_queue_cmd(razer_dev, RAZER_CMD_EFFECT,
+				 RAZER_EFFECT_BREATH,
+				 (const unsigned char *)buf,
+				 (count == 3 || count == 6) ? count : 0);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Read device file "pacing_gap_us"
+ * Returns the learned gap between two transfers in microseconds.
+ */
+static ssize_t razer_attr_read_pacing_gap_us(struct device *dev,
+					     struct device_attribute *attr,
+					     char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", razer_get_pacing_gap(razer_dev));
+}
+
+/*
+ * Write device file "pacing_gap_us"
+ * Restarts learning from the ASCII number of microseconds written.
+ */
+static ssize_t razer_attr_write_pacing_gap_us(struct device *dev,
+					      struct device_attribute *attr,
+					      const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	unsigned int temp;
+	int retval;
+
+	retval = kstrtouint(buf, 10, &temp);
+	if (retval != 0) {
+		pr_warn("pacing_gap_us: requires an ASCII number\n");
+		return retval;
+	}
+
+	retval = razer_set_pacing_gap(razer_dev, temp);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Read device file "pacing_max_us"
+ * Returns the upper bound of the learned gap in microseconds.
+ */
+static ssize_t razer_attr_read_pacing_max_us(struct device *dev,
+					     struct device_attribute *attr,
+					     char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", razer_get_pacing_max(razer_dev));
+}
+
+/*
+ * Write device file "pacing_max_us"
+ * Sets the upper bound of the learned gap to the ASCII number written.
+ */
+static ssize_t razer_attr_write_pacing_max_us(struct device *dev,
+					      struct device_attribute *attr,
+					      const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	unsigned int temp;
+	int retval;
+
+	retval = kstrtouint(buf, 10, &temp);
+	if (retval != 0) {
+		pr_warn("pacing_max_us: requires an ASCII number\n");
+		return retval;
+	}
+
+	retval = razer_set_pacing_max(razer_dev, temp);
+	if (retval != 0)
+		return retval;
+
+	return count;
+}
+
+/*
+ * Read device file "inflight_depth"
+ * Returns the number of batch requests sent before their responses are
+ * fetched.
+ */
+static ssize_t razer_attr_read_inflight_depth(struct device *dev,
+					      struct device_attribute *attr,
+					      char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", razer_get_inflight_depth(razer_dev));
+}
+
+/*
+ * Write device file "inflight_depth"
+ * Sets the number of batch requests in flight to the ASCII number written.
+ */
+static ssize_t razer_attr_write_inflight_depth(struct device *dev,
 					       struct device_attribute *attr,
 					       const char *buf, size_t count)
 {
 	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	unsigned int temp;
 	int retval;
 
-	retval = razer_set_key_colors(razer_dev,
-				      (unsigned char *)&buf[0], count);
+	retval = kstrtouint(buf, 10, &temp);
+	if (retval != 0) {
+		pr_warn("inflight_depth: requires an ASCII number\n");
+		return retval;
+	}
+
+	retval = razer_set_inflight_depth(razer_dev, temp);
 	if (retval != 0)
 		return retval;
 
-	retval = razer_set_custom_mode(razer_dev);
+	return count;
+}
+
+/*
+ * Read device file "busy_backoff"
+ * Returns one line per configurable command class:
+ * class, initial delay (us), maximum delay (us), deadline (ms)
+ */
+static ssize_t razer_attr_read_busy_backoff(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_backoff backoff;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < RAZER_BACKOFF_CLASSES; i++) {
+		razer_get_backoff(razer_dev, i, &backoff);
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "0x%02x %u %u %u\n", i, backoff.initial_us,
+				 backoff.max_us, backoff.deadline_ms);
+	}
+
+	return len;
+}
+
+/*
+ * Write device file "busy_backoff"
+ * Sets the busy schedule of a command class. Expects the ASCII line:
+ * class initial_us max_us deadline_ms
+ */
+static ssize_t razer_attr_write_busy_backoff(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_backoff backoff;
+	unsigned int command_class;
+	char class_str[16];
+	int retval;
+
+	if (sscanf(buf, "%15s %u %u %u", class_str, &backoff.initial_us,
+		   &backoff.max_us, &backoff.deadline_ms) != 4) {
+		pr_warn("busy_backoff: requires class initial_us max_us "
+			"deadline_ms\n");
+		return -EINVAL;
+	}
+
+	// The class is decimal, or hexadecimal with 0x prefix.
+	if (kstrtouint(class_str, 0, &command_class) != 0 ||
+	    command_class > 0xFF)
+		return -EINVAL;
+
+	retval = razer_set_backoff(razer_dev, command_class, &backoff);
 	if (retval != 0)
 		return retval;
 
@@ -851,17 +3040,66 @@ static ssize_t razer_attr_write_set_key_colors(struct device *dev,
 }
 
 /*
- * Write device file "mode_none"
- * Disable keyboard effects / turns the keyboard LEDs off.
+ * Read device file "command_policy"
+ * Returns one line per configurable command class:
+ * class, policy (confirm or deferred)
  */
-static ssize_t razer_attr_write_mode_none(struct device *dev,
-					  struct device_attribute *attr,
-					  const char *buf, size_t count)
+static ssize_t razer_attr_read_command_policy(struct device *dev,
+					      struct device_attribute *attr,
+					      char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < RAZER_POLICY_CLASSES; i++) {
+		len += scnprintf(buf + len, PAGE_SIZE - len, "0x%02x %s\n", i,
+				 razer_get_policy(razer_dev, i) ==
+				 RAZER_POLICY_DEFERRED ? "deferred" : "confirm");
+	}
+
+	return len;
+}
+
+/*
+ * Write device file "command_policy"
+ * Sets the response policy of a command class. Expects the ASCII line:
+ * class confirm|deferred
+ */
+static ssize_t razer_attr_write_command_policy(struct device *dev,
+					       struct device_attribute *attr,
+					       const char *buf, size_t count)
 {
 	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	enum razer_policy policy;
+	unsigned int command_class;
+	char class_str[16];
+	char name[16];
 	int retval;
 
-	retval = razer_set_none_mode(razer_dev);
+	if (sscanf(buf, "%15s %15s", class_str, name) != 2) {
+		pr_warn("command_policy: requires class confirm|deferred\n");
+		return -EINVAL;
+	}
+
+	// The class is decimal, or hexadecimal with 0x prefix.
+	if (kstrtouint(class_str, 0, &command_class) != 0)
+		return -EINVAL;
+
+	if (strcmp(name, "confirm") == 0)
+		policy = RAZER_POLICY_CONFIRM;
+	else if (strcmp(name, "deferred") == 0)
+		policy = RAZER_POLICY_DEFERRED;
+	else
+		return -EINVAL;
+
+	if (command_class > 0xFF)
+		return -EINVAL;
+
+	// Don't leave a deferred response behind a confirmed class.
+	razer_queue_call(razer_dev, razer_call_settle, NULL);
+
+	retval = razer_set_policy(razer_dev, command_class, policy);
 	if (retval != 0)
 		return retval;
 
@@ -869,227 +3107,655 @@ static ssize_t razer_attr_write_mode_none(struct device *dev,
 }
 
 /*
- * Write device file "mode_static"
- * Set the keyboard to static mode when 3 RGB bytes are written.
+ * Read device file "error"
+ * Returns the first error of a deferred request or 0.
  */
-static ssize_t razer_attr_write_mode_static(struct device *dev,
+static ssize_t razer_attr_read_error(struct device *dev,
+				     struct device_attribute *attr,
+				     char *buf)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", razer_get_sticky_error(razer_dev, false));
+}
+
+/*
+ * Write device file "error"
+ * Any write clears the error.
+ */
+static ssize_t razer_attr_write_error(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+
+	razer_get_sticky_error(razer_dev, true);
+
+	return count;
+}
+
+/*
+ * Read device file "busy_polls"
+ * Returns a histogram of the BUSY polls requests needed.
+ */
+static ssize_t razer_attr_read_busy_polls(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	static const char * const labels[RAZER_POLL_BUCKETS] = {
+		"0", "1", "2", "3-4", "5-8", "9-16", "17-32", "33+"
+	};
+	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	u64 polls[RAZER_POLL_BUCKETS];
+	ssize_t len = 0;
+	int i;
+
+	razer_get_busy_polls(razer_dev, polls);
+
+	for (i = 0; i < RAZER_POLL_BUCKETS; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %llu\n",
+				 labels[i], (unsigned long long)polls[i]);
+
+	return len;
+}
+
+/*
+ * Read device files in "stats"
+ * Each file returns a single transport counter as number.
+ */
+#define RAZER_STATS_ATTR(_name, _value)					\
+static ssize_t razer_attr_read_stats_##_name(struct device *dev,	\
+					     struct device_attribute *attr, \
+					     char *buf)				\
+{									\
+	struct razer_device *razer_dev = dev_get_drvdata(dev);		\
+	struct razer_stats stats;					\
+									\
+	razer_get_stats(razer_dev, &stats);				\
+									\
+	return sprintf(buf, "%llu\n", (unsigned long long)(_value));	\
+}									\
+static struct device_attribute dev_attr_stats_##_name =			\
+	__ATTR(_name, 0444, razer_attr_read_stats_##_name, NULL)
+
+RAZER_STATS_ATTR(commands,      stats.commands);
+RAZER_STATS_ATTR(bytes,         stats.bytes);
+RAZER_STATS_ATTR(success,       stats.status[RAZER_STATUS_SUCCESS]);
+RAZER_STATS_ATTR(busy,          stats.status[RAZER_STATUS_BUSY]);
+RAZER_STATS_ATTR(failure,       stats.status[RAZER_STATUS_FAILURE]);
+RAZER_STATS_ATTR(timeout,       stats.status[RAZER_STATUS_TIMEOUT]);
+RAZER_STATS_ATTR(not_supported, stats.status[RAZER_STATUS_NOT_SUPPORTED]);
+RAZER_STATS_ATTR(retries,       stats.retries);
+RAZER_STATS_ATTR(lock_wait_ns,  stats.lock_wait_ns);
+RAZER_STATS_ATTR(sleep_ns,      stats.sleep_ns);
+
+/*
+ * Read device file "stats/frames"
+ * Returns the amount of frames committed by the frame scheduler.
+ */
+static ssize_t razer_attr_read_stats_frames(struct device *dev,
 					    struct device_attribute *attr,
-					    const char *buf, size_t count)
+					    char *buf)
+{
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
+	struct razer_frame_sched *sched = &data->sched;
+	unsigned long flags;
+	u64 committed;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	committed = sched->committed;
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	return sprintf(buf, "%llu\n", (unsigned long long)committed);
+}
+
+static struct device_attribute dev_attr_stats_frames =
+	__ATTR(frames, 0444, razer_attr_read_stats_frames, NULL);
+
+//######################################//
+//### Set up the device driver files ###//
+//######################################//
+
+/*
+ * Read only is 0444
+ * Write only is 0220
+ * Read and write is 0664
+ */
+
+static DEVICE_ATTR(get_serial,              0444, razer_attr_read_get_serial,           NULL);
+static DEVICE_ATTR(get_firmware_version,    0444, razer_attr_read_get_firmware_version, NULL);
+static DEVICE_ATTR(device_type,             0444, razer_attr_read_device_type,          NULL);
+static DEVICE_ATTR(brightness,              0664, razer_attr_read_brightness, razer_attr_write_brightness);
+static DEVICE_ATTR(refresh,                 0220, NULL, razer_attr_write_refresh);
+static DEVICE_ATTR(flush,                   0220, NULL, razer_attr_write_flush);
+static DEVICE_ATTR(ready,                   0444, razer_attr_read_ready,                NULL);
+static DEVICE_ATTR(pacing_gap_us,           0664, razer_attr_read_pacing_gap_us, razer_attr_write_pacing_gap_us);
+static DEVICE_ATTR(pacing_max_us,           0664, razer_attr_read_pacing_max_us, razer_attr_write_pacing_max_us);
+static DEVICE_ATTR(busy_backoff,            0664, razer_attr_read_busy_backoff, razer_attr_write_busy_backoff);
+static DEVICE_ATTR(busy_polls,              0444, razer_attr_read_busy_polls,           NULL);
+static DEVICE_ATTR(command_policy,          0664, razer_attr_read_command_policy, razer_attr_write_command_policy);
+static DEVICE_ATTR(error,                   0664, razer_attr_read_error, razer_attr_write_error);
+static DEVICE_ATTR(inflight_depth,          0664, razer_attr_read_inflight_depth, razer_attr_write_inflight_depth);
+
+static DEVICE_ATTR(fn_mode,         0664, razer_attr_read_fn_mode, razer_attr_write_fn_mode);
+static DEVICE_ATTR(set_logo,        0220, NULL, razer_attr_write_set_logo);
+static DEVICE_ATTR(set_key_colors,  0220, NULL, razer_attr_write_set_key_colors);
+static DEVICE_ATTR(frame_rate,      0664, razer_attr_read_frame_rate, razer_attr_write_frame_rate);
+static DEVICE_ATTR(frame_stats,     0444, razer_attr_read_frame_stats, NULL);
+static DEVICE_ATTR(effect,          0664, razer_attr_read_effect, razer_attr_write_effect);
+static DEVICE_ATTR(animation,       0664, razer_attr_read_animation, razer_attr_write_animation);
+static DEVICE_ATTR(get_key_rows,    0444, razer_attr_read_get_key_rows, NULL);
+static DEVICE_ATTR(get_key_columns, 0444, razer_attr_read_get_key_columns, NULL);
+
+static DEVICE_ATTR(mode_none,      0220, NULL, razer_attr_write_mode_none);
+static DEVICE_ATTR(mode_static,    0220, NULL, razer_attr_write_mode_static);
+static DEVICE_ATTR(mode_custom,    0220, NULL, razer_attr_write_mode_custom);
+static DEVICE_ATTR(mode_wave,      0220, NULL, razer_attr_write_mode_wave);
+static DEVICE_ATTR(mode_spectrum,  0220, NULL, razer_attr_write_mode_spectrum);
+static DEVICE_ATTR(mode_reactive,  0220, NULL, razer_attr_write_mode_reactive);
+static DEVICE_ATTR(mode_breath,    0220, NULL, razer_attr_write_mode_breath);
+static DEVICE_ATTR(mode_starlight, 0220, NULL, razer_attr_write_mode_starlight);
+
+// Mode files by razer_effect.
+static struct device_attribute *razer_mode_attrs[] = {
+	[RAZER_EFFECT_NONE]      = &dev_attr_mode_none,
+	[RAZER_EFFECT_STATIC]    = &dev_attr_mode_static,
+	[RAZER_EFFECT_CUSTOM]    = &dev_attr_mode_custom,
+	[RAZER_EFFECT_WAVE]      = &dev_attr_mode_wave,
+	[RAZER_EFFECT_SPECTRUM]  = &dev_attr_mode_spectrum,
+	[RAZER_EFFECT_REACTIVE]  = &dev_attr_mode_reactive,
+	[RAZER_EFFECT_STARLIGHT] = &dev_attr_mode_starlight,
+	[RAZER_EFFECT_BREATH]    = &dev_attr_mode_breath,
+};
+
+static struct attribute *razer_stats_attrs[] = {
+	&dev_attr_stats_commands.attr,
+	&dev_attr_stats_bytes.attr,
+	&dev_attr_stats_success.attr,
+	&dev_attr_stats_busy.attr,
+	&dev_attr_stats_failure.attr,
+	&dev_attr_stats_timeout.attr,
+	&dev_attr_stats_not_supported.attr,
+	&dev_attr_stats_retries.attr,
+	&dev_attr_stats_lock_wait_ns.attr,
+	&dev_attr_stats_sleep_ns.attr,
+	&dev_attr_stats_frames.attr,
+	NULL
+};
+
+static const struct attribute_group razer_stats_group = {
+	.name  = "stats",
+	.attrs = razer_stats_attrs,
+};
+
+static struct attribute *razer_attrs[] = {
+	// Default files
+	&dev_attr_get_serial.attr,
+	&dev_attr_get_firmware_version.attr,
+	&dev_attr_device_type.attr,
+	&dev_attr_brightness.attr,
+	&dev_attr_refresh.attr,
+	&dev_attr_flush.attr,
+	&dev_attr_ready.attr,
+	&dev_attr_pacing_gap_us.attr,
+	&dev_attr_pacing_max_us.attr,
+	&dev_attr_busy_backoff.attr,
+	&dev_attr_busy_polls.attr,
+	&dev_attr_command_policy.attr,
+	&dev_attr_error.attr,
+	&dev_attr_inflight_depth.attr,
+
+	// Custom files depending on the device support.
+	&dev_attr_fn_mode.attr,
+	&dev_attr_set_logo.attr,
+	&dev_attr_set_key_colors.attr,
+	&dev_attr_frame_rate.attr,
+	&dev_attr_frame_stats.attr,
+	&dev_attr_effect.attr,
+	&dev_attr_animation.attr,
+	&dev_attr_get_key_rows.attr,
+	&dev_attr_get_key_columns.attr,
+
+	// Modes
+	&dev_attr_mode_none.attr,
+	&dev_attr_mode_static.attr,
+	&dev_attr_mode_custom.attr,
+	&dev_attr_mode_wave.attr,
+	&dev_attr_mode_spectrum.attr,
+	&dev_attr_mode_reactive.attr,
+	&dev_attr_mode_breath.attr,
+	&dev_attr_mode_starlight.attr,
+	NULL
+};
+
+/*
+ * Hide the device files the model does not support.
+ */
+static umode_t razer_attr_is_visible(struct kobject *kobj,
+				     struct attribute *attr, int index)
+{
+	struct device *dev              = kobj_to_dev(kobj);
+	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
+	const struct razer_model *model = data->model;
+	int i;
+
+	if (attr == &dev_attr_fn_mode.attr)
+		return (model->features & RAZER_FEATURE_FN_MODE) ?
+		       attr->mode : 0;
+
+	if (attr == &dev_attr_set_logo.attr)
+		return (model->features & RAZER_FEATURE_LOGO) ? attr->mode : 0;
+
+	if (attr == &dev_attr_set_key_colors.attr ||
+	    attr == &dev_attr_frame_rate.attr ||
+	    attr == &dev_attr_frame_stats.attr ||
+	    attr == &dev_attr_effect.attr ||
+	    attr == &dev_attr_animation.attr ||
+	    attr == &dev_attr_get_key_rows.attr ||
+	    attr == &dev_attr_get_key_columns.attr)
+		return (model->features & RAZER_FEATURE_KEY_COLORS) ?
+		       attr->mode : 0;
+
+	for (i = 0; i < ARRAY_SIZE(razer_mode_attrs); i++)
+		if (attr == &razer_mode_attrs[i]->attr)
+			return (model->effects & BIT(i)) ? attr->mode : 0;
+
+	return attr->mode;
+}
+
+static const struct attribute_group razer_attr_group = {
+	.attrs      = razer_attrs,
+	.is_visible = razer_attr_is_visible,
+};
+
+static const struct attribute_group *razer_groups[] = {
+	&razer_attr_group,
+	&razer_stats_group,
+	NULL
+};
+
+//##########################//
+//### Framebuffer Device ###//
+//##########################//
+
+static void razer_fb_free(struct kref *kref)
+{
+	struct razer_fb *fb = container_of(kref, struct razer_fb, kref);
+
+	vfree(fb->buf);
+	kfree(fb);
+}
+
+static void razer_fb_vm_open(struct vm_area_struct *vma)
+{
+	struct razer_fb *fb = vma->vm_private_data;
+
+	kref_get(&fb->kref);
+}
+
+static void razer_fb_vm_close(struct vm_area_struct *vma)
+{
+	struct razer_fb *fb = vma->vm_private_data;
+
+	kref_put(&fb->kref, razer_fb_free);
+}
+
+static const struct vm_operations_struct razer_fb_vm_ops = {
+	.open   = razer_fb_vm_open,
+	.close  = razer_fb_vm_close,
+};
+
+static int razer_fb_open(struct inode *inode, struct file *file)
+{
+	// The misc core sets the private data to the miscdevice.
+	struct miscdevice *misc = file->private_data;
+	struct razer_fb *fb     = container_of(misc, struct razer_fb, misc);
+
+	kref_get(&fb->kref);
+	file->private_data = fb;
+
+	return 0;
+}
+
+static int razer_fb_release(struct inode *inode, struct file *file)
+{
+	struct razer_fb *fb = file->private_data;
+
+	kref_put(&fb->kref, razer_fb_free);
+
+	return 0;
+}
+
+static ssize_t razer_fb_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
 {
-	struct razer_device *razer_dev = dev_get_drvdata(dev);
-	int retval;
+	struct razer_fb *fb = file->private_data;
 
-	if (count != 3) {
-		pr_warn("mode static requires 3 RGB bytes\n");
-		return -EINVAL;
-	}
+	return simple_read_from_buffer(buf, count, ppos, fb->buf, fb->size);
+}
 
-	retval = razer_set_static_mode(razer_dev, (struct razer_rgb *)&buf[0]);
-	if (retval != 0)
-		return retval;
+static ssize_t razer_fb_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct razer_fb *fb = file->private_data;
 
-	return count;
+	return simple_write_to_buffer(fb->buf, fb->size, ppos, buf, count);
 }
 
-/*
- * Write device file "mode_custom"
- * Sets the keyboard to custom mode whenever the file is written to.
- */
-static ssize_t razer_attr_write_mode_custom(struct device *dev,
-					    struct device_attribute *attr,
-					    const char *buf, size_t count)
+static int razer_fb_mmap(struct file *file, struct vm_area_struct *vma)
 {
-	struct razer_device *razer_dev = dev_get_drvdata(dev);
+	struct razer_fb *fb = file->private_data;
 	int retval;
 
-	retval = razer_set_custom_mode(razer_dev);
+	retval = remap_vmalloc_range(vma, fb->buf, vma->vm_pgoff);
 	if (retval != 0)
 		return retval;
 
-	return count;
+	vma->vm_private_data = fb;
+	vma->vm_ops          = &razer_fb_vm_ops;
+	razer_fb_vm_open(vma);
+
+	return 0;
 }
 
 /*
- * Write device file "mode_wave"
- * If the ASCII number 1 is written then the wave effect is displayed
- * moving left across the keyboard.
- * If the ASCII number 2 is written then the wave effect goes right.
+ * Queue a snapshot of the framebuffer for the device.
+ * The frame scheduler copies it, so userspace may keep drawing.
  */
-static ssize_t razer_attr_write_mode_wave(struct device *dev,
-					  struct device_attribute *attr,
-					  const char *buf, size_t count)
+static long razer_fb_commit(struct razer_fb *fb)
 {
-	struct razer_device *razer_dev  = dev_get_drvdata(dev);
-	unsigned long temp;
-	int retval;
+	struct razer_data *data;
+	long retval = -ENODEV;
 
-	retval = kstrtoul(buf, 10, &temp);
-	if (retval != 0) {
-		pr_warn("mode_wave: requires an ASCII number\n");
-		return retval;
-	}
+	mutex_lock(&fb->lock);
+	if (fb->razer_dev) {
+		// Frames of userspace replace the software effect and the
+		// animation.
+		data = fb->razer_dev->data;
+		razer_fx_stop(&data->fx);
+		razer_anim_stop(&data->anim);
 
-	retval = razer_set_wave_mode(razer_dev, temp);
-	if (retval != 0)
-		return retval;
+		retval = razer_frame_submit(fb->razer_dev, fb->buf, fb->size);
+	}
+	mutex_unlock(&fb->lock);
 
-	return count;
+	return retval;
 }
 
 /*
- * Write device file "mode_spectrum"
- * Specrum effect mode is activated whenever the file is written to.
+ * Send a batch of raw reports under a single device lock hold.
+ * Runs on the device workqueue through razer_queue_call.
  */
-static ssize_t razer_attr_write_mode_spectrum(struct device *dev,
-					      struct device_attribute *attr,
-					      const char *buf, size_t count)
+static int razer_call_batch(struct razer_device *razer_dev, void *arg)
 {
-	struct razer_device *razer_dev = dev_get_drvdata(dev);
-	int retval;
+	struct razer_batch_call *call = arg;
 
-	retval = razer_set_spectrum_mode(razer_dev);
-	if (retval != 0)
-		return retval;
+	// The result of each report is returned through status.
+	razer_send_batch(razer_dev, call->reports, call->status, call->count);
 
-	return count;
+	// Raw reports may have changed any device state.
+	razer_invalidate_state(razer_dev->data);
+
+	return 0;
 }
 
 /*
- * Write device file "mode_reactive"
- * Sets reactive mode when this file is written to.
- * A speed byte and 3 RGB bytes should be written.
- * The speed must be within 1-3
- * 1 Short, 2 Medium, 3 Long
+ * Send a batch of raw reports of userspace.
+ * The batch is dispatched like any other device I/O, so queued interactive
+ * commands are sent first.
  */
-static ssize_t razer_attr_write_mode_reactive(struct device *dev,
-					      struct device_attribute *attr,
-					      const char *buf, size_t count)
+static long razer_fb_batch(struct razer_fb *fb, struct file *file,
+			   void __user *argp)
 {
-	struct razer_device *razer_dev = dev_get_drvdata(dev);
-	int retval;
+	struct razer_batch_call call;
+	struct razer_batch batch;
+	struct razer_report *reports;
+	int *status;
+	long retval;
+	u32 i;
 
-	if (count != 4) {
-		pr_warn("mode reactive requires one speed byte followed by 3 RGB bytes\n");
+	BUILD_BUG_ON(sizeof(struct razer_report) != RAZER_REPORT_SIZE);
+
+	if (!(file->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch.flags != 0 || batch.count == 0 ||
+	    batch.count > RAZER_BATCH_MAX)
 		return -EINVAL;
+
+	reports = memdup_user(u64_to_user_ptr(batch.reports),
+			      batch.count * sizeof(*reports));
+	if (IS_ERR(reports))
+		return PTR_ERR(reports);
+
+	for (i = 0; i < batch.count; i++) {
+		if (reports[i].data_size > sizeof(reports[i].arguments)) {
+			retval = -EINVAL;
+			goto exit_free_reports;
+		}
 	}
 
-	retval = razer_set_reactive_mode(razer_dev,
-					 (unsigned char)buf[0],
-					 (struct razer_rgb *)&buf[1]);
-	if (retval != 0)
-		return retval;
+	status = kcalloc(batch.count, sizeof(*status), GFP_KERNEL);
+	if (!status) {
+		retval = -ENOMEM;
+		goto exit_free_reports;
+	}
 
-	return count;
+	mutex_lock(&fb->lock);
+	if (!fb->razer_dev) {
+		mutex_unlock(&fb->lock);
+		retval = -ENODEV;
+		goto exit_free_status;
+	}
+
+	call.reports = reports;
+	call.status  = status;
+	call.count   = batch.count;
+	razer_queue_call(fb->razer_dev, razer_call_batch, &call);
+	mutex_unlock(&fb->lock);
+
+	retval = 0;
+	if (copy_to_user(u64_to_user_ptr(batch.status), status,
+			 batch.count * sizeof(*status)))
+		retval = -EFAULT;
+
+exit_free_status:
+	kfree(status);
+exit_free_reports:
+	kfree(reports);
+
+	return retval;
 }
 
 /*
- * Write device file "mode_starlight"
- * Requires at least one byte representing the effect speed.
- * The speed must be within 1-3
- * 1 Short, 2 Medium, 3 Long
- *
- * Starlight mode has 3 modes of operation:
- *   Mode 1: single color. 3 RGB bytes.
- *   Mode 2: two colors. 6 RGB bytes.
- *   Mode 3: random colors. Anything else passed.
+ * Replace the animation of the device with frames and durations of
+ * userspace. The animation is kept in a vmalloc'd buffer.
  */
-static ssize_t razer_attr_write_mode_starlight(struct device *dev,
-					       struct device_attribute *attr,
-					       const char *buf, size_t count)
+static long razer_fb_anim_load(struct razer_fb *fb, struct file *file,
+			       void __user *argp)
 {
-	struct razer_device *razer_dev  = dev_get_drvdata(dev);
-	struct razer_rgb *color1        = NULL;
-	struct razer_rgb *color2        = NULL;
-	int retval;
+	struct razer_anim anim;
+	struct razer_data *data;
+	size_t durations_size;
+	u32 *durations;
+	long retval;
+	u32 i;
 
-	if (count < 1) {
-		pr_warn("mode starlight requires one speed byte\n");
+	if (!(file->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	if (copy_from_user(&anim, argp, sizeof(anim)))
+		return -EFAULT;
+
+	if ((anim.flags & ~RAZER_ANIM_LOOP) || anim.count == 0 ||
+	    anim.count > RAZER_ANIM_MAX_FRAMES)
 		return -EINVAL;
+
+	// The durations come first, so they are aligned.
+	durations_size = anim.count * sizeof(*durations);
+	durations = vmalloc(durations_size + anim.count * fb->size);
+	if (!durations)
+		return -ENOMEM;
+
+	if (copy_from_user(durations, u64_to_user_ptr(anim.durations),
+			   durations_size) ||
+	    copy_from_user((unsigned char *)durations + durations_size,
+			   u64_to_user_ptr(anim.frames),
+			   anim.count * fb->size)) {
+		retval = -EFAULT;
+		goto exit_free;
+	}
+
+	for (i = 0; i < anim.count; i++) {
+		if (durations[i] == 0 ||
+		    durations[i] > RAZER_ANIM_MAX_DURATION_MS) {
+			retval = -EINVAL;
+			goto exit_free;
+		}
 	}
 
-	if (count == 4) {
-		// Single color mode
-		color1 = (struct razer_rgb *)&buf[1];
-	} else if (count == 7) {
-		// Dual color mode
-		color1 = (struct razer_rgb *)&buf[1];
-		color2 = (struct razer_rgb *)&buf[4];
+	mutex_lock(&fb->lock);
+	if (!fb->razer_dev) {
+		mutex_unlock(&fb->lock);
+		retval = -ENODEV;
+		goto exit_free;
 	}
 
-	retval = razer_set_starlight_mode(razer_dev, (unsigned char)buf[0],
-					  color1, color2);
-	if (retval != 0)
-		return retval;
+	data   = fb->razer_dev->data;
+	retval = razer_anim_load(&data->anim, durations, anim.count,
+				 anim.flags);
+	mutex_unlock(&fb->lock);
 
-	return count;
+	// The player owns the buffer now.
+	if (retval == 0)
+		return 0;
+
+exit_free:
+	vfree(durations);
+
+	return retval;
+}
+
+static long razer_fb_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct razer_fb *fb         = file->private_data;
+	void __user *argp           = (void __user *)arg;
+	struct razer_fb_info info;
+
+	switch (cmd) {
+	case RAZER_IOC_GET_INFO:
+		memset(&info, 0, sizeof(info));
+		info.rows    = fb->rows;
+		info.columns = fb->columns;
+		info.size    = fb->size;
+
+		if (copy_to_user(argp, &info, sizeof(info)))
+			return -EFAULT;
+		return 0;
+
+	case RAZER_IOC_COMMIT:
+		return razer_fb_commit(fb);
+
+	case RAZER_IOC_BATCH:
+		return razer_fb_batch(fb, file, argp);
+
+	case RAZER_IOC_ANIM_LOAD:
+		return razer_fb_anim_load(fb, file, argp);
+
+	default:
+		return -ENOTTY;
+	}
 }
 
+static const struct file_operations razer_fb_fops = {
+	.owner          = THIS_MODULE,
+	.open           = razer_fb_open,
+	.release        = razer_fb_release,
+	.read           = razer_fb_read,
+	.write          = razer_fb_write,
+	.mmap           = razer_fb_mmap,
+	.unlocked_ioctl = razer_fb_ioctl,
+	.compat_ioctl   = compat_ptr_ioctl,
+	.llseek         = default_llseek,
+};
+
 /*
- * Write device file "mode_breath"
- * Breathing mode has 3 modes of operation.
- * Mode 1 fading in and out using a single color. 3 RGB bytes.
- * Mode 2 is fading in and out between two colors. 6 RGB bytes.
- * Mode 3 is fading in and out between random colors. Anything else passed.
+ * Create the framebuffer device of a razer device.
+ * Returns NULL on error.
  */
-static ssize_t razer_attr_write_mode_breath(struct device *dev,
-					    struct device_attribute *attr,
-					    const char *buf, size_t count)
+struct razer_fb *razer_fb_create(struct hid_device *hdev,
+				 struct razer_device *razer_dev,
+				 unsigned int rows, unsigned int columns)
 {
-	struct razer_device *razer_dev  = dev_get_drvdata(dev);
-	struct razer_rgb *color1        = NULL;
-	struct razer_rgb *color2        = NULL;
+	struct razer_fb *fb;
 	int retval;
 
-	if (count == 3) {
-		// Single color mode
-		color1 = (struct razer_rgb *)&buf[0];
-	} else if (count == 6) {
-		// Dual color mode
-		color1 = (struct razer_rgb *)&buf[0];
-		color2 = (struct razer_rgb *)&buf[3];
+	fb = kzalloc(sizeof(*fb), GFP_KERNEL);
+	if (!fb)
+		return NULL;
+
+	fb->rows    = rows;
+	fb->columns = columns;
+	fb->size    = rows * columns * 3;
+	fb->buf     = vmalloc_user(fb->size);
+	if (!fb->buf) {
+		kfree(fb);
+		return NULL;
 	}
 
-	retval = razer_set_breath_mode(razer_dev, color1, color2);
-	if (retval != 0)
-		return retval;
+	kref_init(&fb->kref);
+	mutex_init(&fb->lock);
+	fb->razer_dev = razer_dev;
 
-	return count;
-}
+	snprintf(fb->name, sizeof(fb->name), "razer-fb-%s", dev_name(&hdev->dev));
+	fb->misc.minor  = MISC_DYNAMIC_MINOR;
+	fb->misc.name   = fb->name;
+	fb->misc.fops   = &razer_fb_fops;
+	fb->misc.parent = &hdev->dev;
 
-//######################################//
-//### Set up the device driver files ###//
-//######################################//
+	retval = misc_register(&fb->misc);
+	if (retval != 0) {
+		hid_err(hdev, "failed to register framebuffer device\n");
+		kref_put(&fb->kref, razer_fb_free);
+		return NULL;
+	}
+
+	return fb;
+}
 
 /*
- * Read only is 0444
- * Write only is 0220
- * Read and write is 0664
+ * Remove the framebuffer device. Open files and mappings stay valid,
+ * but commits fail with -ENODEV.
  */
+void razer_fb_destroy(struct razer_fb *fb)
+{
+	if (!fb)
+		return;
 
-static DEVICE_ATTR(get_serial,              0444, razer_attr_read_get_serial,           NULL);
-static DEVICE_ATTR(get_firmware_version,    0444, razer_attr_read_get_firmware_version, NULL);
-static DEVICE_ATTR(device_type,             0444, razer_attr_read_device_type,          NULL);
-static DEVICE_ATTR(brightness,              0664, razer_attr_read_brightness, razer_attr_write_brightness);
+	misc_deregister(&fb->misc);
 
-static DEVICE_ATTR(fn_mode,         0664, razer_attr_read_fn_mode, razer_attr_write_fn_mode);
-static DEVICE_ATTR(set_logo,        0220, NULL, razer_attr_write_set_logo);
-static DEVICE_ATTR(set_key_colors,  0220, NULL, razer_attr_write_set_key_colors);
-static DEVICE_ATTR(get_key_rows,    0444, razer_attr_read_get_key_rows, NULL);
-static DEVICE_ATTR(get_key_columns, 0444, razer_attr_read_get_key_columns, NULL);
+	mutex_lock(&fb->lock);
+	fb->razer_dev = NULL;
+	mutex_unlock(&fb->lock);
 
-static DEVICE_ATTR(mode_none,      0220, NULL, razer_attr_write_mode_none);
-static DEVICE_ATTR(mode_static,    0220, NULL, razer_attr_write_mode_static);
-static DEVICE_ATTR(mode_custom,    0220, NULL, razer_attr_write_mode_custom);
-static DEVICE_ATTR(mode_wave,      0220, NULL, razer_attr_write_mode_wave);
-static DEVICE_ATTR(mode_spectrum,  0220, NULL, razer_attr_write_mode_spectrum);
-static DEVICE_ATTR(mode_reactive,  0220, NULL, razer_attr_write_mode_reactive);
-static DEVICE_ATTR(mode_breath,    0220, NULL, razer_attr_write_mode_breath);
-static DEVICE_ATTR(mode_starlight, 0220, NULL, razer_attr_write_mode_starlight);
+	kref_put(&fb->kref, razer_fb_free);
+}
 
 //#############################//
 //### Driver Main Functions ###//
 //#############################//
 
+// All bound devices. Key presses reported by one HID interface light the
+// reactive effects of every interface of the same keyboard.
+static LIST_HEAD(razer_data_list);
+static DEFINE_SPINLOCK(razer_data_list_lock);
+
 /*
  * Initialize a razer_data struct.
  */
@@ -1098,6 +3764,15 @@ int razer_init_data(struct razer_data *data)
 	// Set all values to an unset state.
 	data->macro_keys_state  = -1;
 	data->fn_mode_state     = -1;
+	data->key_colors        = NULL;
+	data->key_colors_valid  = false;
+	mutex_init(&data->key_colors_lock);
+	mutex_init(&data->cache_lock);
+	data->brightness        = -1;
+	razer_queue_init(&data->queue);
+	razer_frame_sched_init(&data->sched);
+	razer_fx_init(&data->fx);
+	razer_anim_init(&data->anim);
 
 	return 0;
 }
@@ -1131,6 +3806,54 @@ int razer_load_states(struct razer_device *razer_dev)
 	return 0;
 }
 
+/*
+ * Cache the device information and restore the device states.
+ * Runs on the device workqueue, so probe and resume do not wait for the
+ * device. Queued attribute writes are executed afterwards.
+ */
+static void razer_init_work(struct work_struct *work)
+{
+	struct razer_data *data =
+		container_of(work, struct razer_data, init_work);
+	struct razer_device *razer_dev = data->queue.razer_dev;
+
+	// Unknown values are queried on read.
+	razer_refresh_cache(razer_dev);
+
+	// Ignore errors. They are not fatal. Errors will be logged.
+	razer_load_states(razer_dev);
+
+	WRITE_ONCE(data->ready, true);
+	sysfs_notify(&data->dev->kobj, NULL, "ready");
+}
+
+/*
+ * Called for every parsed HID usage of an input report.
+ * Key presses are passed to the reactive effects of the keyboard in
+ * interrupt context, so they are shown with the next frame.
+ */
+static int razer_event(struct hid_device *hdev, struct hid_field *field,
+		       struct hid_usage *usage, __s32 value)
+{
+	struct razer_device *razer_dev = hid_get_drvdata(hdev);
+	struct razer_data *data;
+	unsigned long flags;
+
+	if (!razer_dev || value == 0 ||
+	    (usage->hid & HID_USAGE_PAGE) != HID_UP_KEYBOARD)
+		return 0;
+
+	spin_lock_irqsave(&razer_data_list_lock, flags);
+	list_for_each_entry(data, &razer_data_list, node) {
+		if (data->queue.razer_dev->usb_dev == razer_dev->usb_dev)
+			razer_fx_press(&data->fx, usage->hid & HID_USAGE);
+	}
+	spin_unlock_irqrestore(&razer_data_list_lock, flags);
+
+	// Let hid-input report the key.
+	return 0;
+}
+
 /*
  * Probe method is ran whenever a device is bound to the driver.
  */
@@ -1143,7 +3866,13 @@ static int razer_probe(struct hid_device *hdev,
 	struct usb_device *usb_dev      = interface_to_usbdev(intf);
 	struct razer_device *razer_dev;
 	struct razer_data *data;
-	const unsigned int product_id   = usb_dev->descriptor.idProduct;
+	const struct razer_model *model;
+
+	model = razer_find_model(le16_to_cpu(usb_dev->descriptor.idProduct));
+	if (!model) {
+		hid_err(hdev, "unsupported device\n");
+		return -ENODEV;
+	}
 
 	razer_dev = kzalloc(sizeof(*razer_dev), GFP_KERNEL);
 	if (!razer_dev) {
@@ -1157,11 +3886,13 @@ static int razer_probe(struct hid_device *hdev,
 		goto exit_free_razer_dev;
 	}
 
+	razer_create_debugfs(razer_dev, dev_name(&hdev->dev));
+
 	data = kzalloc(sizeof(*data), GFP_KERNEL);
 	if (!data) {
 		hid_err(hdev, "can't alloc razer data\n");
 		retval = -ENOMEM;
-		goto exit_free_razer_dev;
+		goto exit_deinit_razer_dev;
 	}
 
 	retval = razer_init_data(data);
@@ -1170,109 +3901,48 @@ static int razer_probe(struct hid_device *hdev,
 		goto exit_free;
 	}
 
+	// Default states of the model.
+	data->model             = model;
+	data->fn_mode_state     = model->fn_mode_state;
+	data->macro_keys_state  = model->macro_keys_state;
+
 	dev_set_drvdata(dev, razer_dev);
 	razer_dev->data         = data;
 	razer_dev->report_index = RAZER_DEFAULT_REPORT_INDEX;
 
-	// Default files
-	retval = device_create_file(dev, &dev_attr_get_serial);
-	if (retval)
-		goto exit_free;
-	retval = device_create_file(dev, &dev_attr_get_firmware_version);
-	if (retval)
-		goto exit_free;
-	retval = device_create_file(dev, &dev_attr_device_type);
-	if (retval)
-		goto exit_free;
-	retval = device_create_file(dev, &dev_attr_brightness);
-	if (retval)
+	// Ordered workqueue for all USB I/O triggered by attribute writes.
+	data->wq = alloc_ordered_workqueue("razer-%s", 0, dev_name(dev));
+	if (!data->wq) {
+		retval = -ENOMEM;
 		goto exit_free;
-
-	// Custom files depending on the device support.
-	// #############################################
-	if (product_id == USB_DEVICE_ID_RAZER_BLADE_STEALTH_2016 ||
-	    product_id == USB_DEVICE_ID_RAZER_BLADE_14_2016) {
-		// Set the default fn mode state.
-		data->fn_mode_state = 1;
-
-		retval = device_create_file(dev, &dev_attr_fn_mode);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_get_key_rows);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_get_key_columns);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_set_logo);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_set_key_colors);
-		if (retval)
+	}
+	data->queue.razer_dev = razer_dev;
+	data->dev             = dev;
+	INIT_WORK(&data->init_work, razer_init_work);
+
+	// Shadow copy of the key colors if the device supports custom frames.
+	if (model->features & RAZER_FEATURE_KEY_COLORS) {
+		data->key_colors = kcalloc(model->rows, model->columns * 3,
+					   GFP_KERNEL);
+		if (!data->key_colors) {
+			retval = -ENOMEM;
 			goto exit_free;
+		}
+	}
 
-		// Modes
-		retval = device_create_file(dev, &dev_attr_mode_none);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_static);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_custom);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_wave);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_spectrum);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_reactive);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_breath);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_starlight);
-		if (retval)
-			goto exit_free;
-	} else if (product_id == USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA) {
-		// Enable the macro keys state.
-		data->macro_keys_state = 1;
+	retval = razer_frame_sched_setup(&data->sched, razer_dev, data->wq,
+					 data->key_colors ?
+					 model->rows * model->columns * 3 : 0);
+	if (retval != 0)
+		goto exit_free;
 
-		retval = device_create_file(dev, &dev_attr_get_key_rows);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_get_key_columns);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_set_key_colors);
-		if (retval)
-			goto exit_free;
+	retval = razer_fx_setup(&data->fx, razer_dev, data->wq, model);
+	if (retval != 0)
+		goto exit_free;
 
-		// Modes
-		retval = device_create_file(dev, &dev_attr_mode_none);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_static);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_custom);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_wave);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_spectrum);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_reactive);
-		if (retval)
-			goto exit_free;
-		retval = device_create_file(dev, &dev_attr_mode_breath);
-		if (retval)
-			goto exit_free;
-	}
+	razer_anim_setup(&data->anim, razer_dev, data->wq,
+			 data->key_colors ?
+			 model->rows * model->columns * 3 : 0);
 
 	retval = hid_parse(hdev);
 	if (retval)    {
@@ -1285,15 +3955,31 @@ static int razer_probe(struct hid_device *hdev,
 		goto exit_free;
 	}
 
+	// Framebuffer device for custom frames. Not fatal if it fails.
+	if (data->key_colors)
+		data->fb = razer_fb_create(hdev, razer_dev,
+					   model->rows, model->columns);
+
 	usb_disable_autosuspend(usb_dev);
 
-	// Finally load any set states. Ignore errors. They are not fatal.
-	// Errors will be logged.
-	razer_load_states(razer_dev);
+	spin_lock_irq(&razer_data_list_lock);
+	list_add_tail(&data->node, &razer_data_list);
+	spin_unlock_irq(&razer_data_list_lock);
+
+	// Finally load any set states in the background.
+	queue_work(data->wq, &data->init_work);
 
 	return 0;
 exit_free:
+	razer_anim_destroy(&data->anim);
+	razer_fx_destroy(&data->fx);
+	razer_frame_sched_destroy(&data->sched);
+	if (data->wq)
+		destroy_workqueue(data->wq);
+	kfree(data->key_colors);
 	kfree(data);
+exit_deinit_razer_dev:
+	razer_deinit_device(razer_dev);
 exit_free_razer_dev:
 	kfree(razer_dev);
 	return retval;
@@ -1305,54 +3991,26 @@ exit_free_razer_dev:
 static void razer_disconnect(struct hid_device *hdev)
 {
 	struct device *dev              = &hdev->dev;
-	struct usb_interface *intf      = to_usb_interface(dev->parent);
-	struct usb_device *usb_dev      = interface_to_usbdev(intf);
 	struct razer_device *razer_dev  = dev_get_drvdata(dev);
 	struct razer_data *data         = razer_dev->data;
-	const unsigned int product_id   = usb_dev->descriptor.idProduct;
 
-	// Remove the default files
-	device_remove_file(dev, &dev_attr_get_firmware_version);
-	device_remove_file(dev, &dev_attr_get_serial);
-	device_remove_file(dev, &dev_attr_device_type);
-	device_remove_file(dev, &dev_attr_brightness);
+	// No more key presses for the effect engine.
+	spin_lock_irq(&razer_data_list_lock);
+	list_del(&data->node);
+	spin_unlock_irq(&razer_data_list_lock);
 
-	// Custom files depending on the device support.
-	// #############################################
-	if (product_id == USB_DEVICE_ID_RAZER_BLADE_STEALTH_2016 ||
-	    product_id == USB_DEVICE_ID_RAZER_BLADE_14_2016) {
-		device_remove_file(dev, &dev_attr_fn_mode);
-		device_remove_file(dev, &dev_attr_get_key_rows);
-		device_remove_file(dev, &dev_attr_get_key_columns);
-		device_remove_file(dev, &dev_attr_set_logo);
-		device_remove_file(dev, &dev_attr_set_key_colors);
-
-		// Modes
-		device_remove_file(dev, &dev_attr_mode_none);
-		device_remove_file(dev, &dev_attr_mode_static);
-		device_remove_file(dev, &dev_attr_mode_custom);
-		device_remove_file(dev, &dev_attr_mode_wave);
-		device_remove_file(dev, &dev_attr_mode_spectrum);
-		device_remove_file(dev, &dev_attr_mode_reactive);
-		device_remove_file(dev, &dev_attr_mode_breath);
-		device_remove_file(dev, &dev_attr_mode_starlight);
-	} else if (product_id == USB_DEVICE_ID_RAZER_BLACKWIDOW_CHROMA) {
-		device_remove_file(dev, &dev_attr_get_key_rows);
-		device_remove_file(dev, &dev_attr_get_key_columns);
-		device_remove_file(dev, &dev_attr_set_key_colors);
-
-		// Modes
-		device_remove_file(dev, &dev_attr_mode_none);
-		device_remove_file(dev, &dev_attr_mode_static);
-		device_remove_file(dev, &dev_attr_mode_custom);
-		device_remove_file(dev, &dev_attr_mode_wave);
-		device_remove_file(dev, &dev_attr_mode_spectrum);
-		device_remove_file(dev, &dev_attr_mode_reactive);
-		device_remove_file(dev, &dev_attr_mode_breath);
-	}
+	razer_fb_destroy(data->fb);
+	razer_anim_destroy(&data->anim);
+	razer_fx_destroy(&data->fx);
+	razer_frame_sched_destroy(&data->sched);
+	cancel_work_sync(&data->init_work);
+	cancel_work_sync(&data->queue.work);
+	destroy_workqueue(data->wq);
 
 	hid_hw_stop(hdev);
+	razer_deinit_device(razer_dev);
 	kfree(razer_dev);
+	kfree(data->key_colors);
 	kfree(data);
 	dev_info(dev, "razer device disconnected\n");
 }
@@ -1378,10 +4036,15 @@ static int razer_resume(struct hid_device *hdev)
 {
 	struct device *dev              = &hdev->dev;
 	struct razer_device *razer_dev  = dev_get_drvdata(dev);
+	struct razer_data *data         = razer_dev->data;
 
-	// Load any set states. Ignore errors. They are not fatal.
-	// Errors will be logged.
-	razer_load_states(razer_dev);
+	// The device lost its custom frame and may have changed brightness.
+	razer_invalidate_state(data);
+
+	// Load any set states in the background.
+	WRITE_ONCE(data->ready, false);
+	sysfs_notify(&dev->kobj, NULL, "ready");
+	queue_work(data->wq, &data->init_work);
 
 	return 0;
 }
@@ -1424,7 +4087,24 @@ static struct hid_driver razer_driver = {
 #endif
 
 	.probe          = razer_probe,
-	.remove         = razer_disconnect
+	.remove         = razer_disconnect,
+	.event          = razer_event,
+
+	// All device files at once, created after a successful probe and
+	// removed before razer_disconnect. Files not supported by the model
+	// are hidden by razer_attr_is_visible.
+	.driver.dev_groups = razer_groups
 };
 
 module_hid_driver(razer_driver);
+
+//###################//
+//### KUnit Tests ###//
+//###################//
+
+// The suite of the keyboard commands and the frame upload benchmark.
+// Both run on the emulator of hid-razer-common.
+#if IS_ENABLED(CONFIG_HID_RAZER_KUNIT_TEST)
+#include "hid-razer-test.c"
+#include "hid-razer-bench.c"
+#endif
@@ -18,6 +18,17 @@
 #define __HID_RAZER_H
 
 #include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/miscdevice.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/bitops.h>
+#include <linux/list.h>
+#include <linux/hrtimer.h>
+
+#include "hid-razer-common.h"
 
 //#################//
 //### Constants ###//
@@ -36,13 +47,325 @@
 #define RAZER_BLACKWIDOW_CHROMA_ROWS    0x06
 #define RAZER_BLACKWIDOW_CHROMA_COLUMNS 0x16
 
+// Features of a model. Each one adds device files.
+#define RAZER_FEATURE_FN_MODE       BIT(0)  // fn_mode
+#define RAZER_FEATURE_LOGO          BIT(1)  // set_logo
+#define RAZER_FEATURE_KEY_COLORS    BIT(2)  // set_key_colors, frame_*, ...
+#define RAZER_FEATURE_MACRO_KEYS    BIT(3)  // Macro keys M1-M5.
+
+// Maximum frame rate of the frame scheduler.
+#define RAZER_FRAME_RATE_MAX        240
+
+// Maximum argument bytes of a queued command.
+#define RAZER_CMD_ARGS_MAX          8
+
+// Software effects: tick rate while the frame scheduler has no rate,
+// longest cycle, scroll columns and characters of scrolling text.
+#define RAZER_FX_DEFAULT_RATE       30
+#define RAZER_FX_PERIOD_MAX_MS      60000
+#define RAZER_FX_BITMAP_MAX         128
+#define RAZER_FX_TEXT_MAX           32
+
+// Key presses remembered by the reactive effects.
+#define RAZER_FX_PRESSES            16
+
+// Unmapped entry of a keymap. Mapped entries hold row << 5 | column.
+#define RAZER_KEY_NONE              0xFF
+
+// Glyph size of the built-in font.
+#define RAZER_FONT_WIDTH            3
+#define RAZER_FONT_HEIGHT           5
+
 //#############//
 //### Types ###//
 //#############//
 
+// Encoding of the brightness commands of a model.
+// The get request carries args, the set request args followed by the value.
+// The response holds the value right after args.
+struct razer_brightness_cmd {
+	unsigned char command_class;
+	unsigned char get_id;
+	unsigned char set_id;
+	unsigned char args[2];
+	unsigned char args_len;
+};
+
+// Position of a key in the LED matrix by its HID keyboard usage.
+struct razer_key_pos {
+	unsigned char usage;
+	unsigned char row;
+	unsigned char column;
+};
+
+// Description of a supported model. Resolved once at probe.
+// effects:          Bitmap of supported razer_effect mode_* files.
+// fn_mode_state:    Default FN mode. Smaller than 0 if not set.
+// macro_keys_state: 1 to enable the macro keys. Smaller than 0 if not set.
+struct razer_model {
+	unsigned short              product_id;
+	const char                  *name;
+	unsigned int                rows;      // 0 without key colors.
+	unsigned int                columns;
+	unsigned long               features;  // RAZER_FEATURE_*
+	unsigned long               effects;
+	struct razer_brightness_cmd brightness;
+	const struct razer_key_pos  *keys;     // Keys lit by reactive effects.
+	unsigned int                keys_len;
+	char                        fn_mode_state;
+	char                        macro_keys_state;
+};
+
+// Memory-mappable framebuffer character device of a razer device.
+// The struct lives as long as the device is bound or userspace holds an
+// open file or mapping.
+struct razer_fb {
+	struct kref         kref;
+	struct miscdevice   misc;
+	char                name[48];
+	struct mutex        lock;       // Protects razer_dev.
+	struct razer_device *razer_dev; // NULL once the device is gone.
+	unsigned char       *buf;       // vmalloc_user'd RGB frame.
+	size_t              size;       // rows * columns * 3
+	unsigned int        rows;
+	unsigned int        columns;
+};
+
+// Arguments of a RAZER_IOC_BATCH run on the device workqueue.
+struct razer_batch_call {
+	struct razer_report *reports;
+	int                 *status;
+	unsigned int        count;
+};
+
+// Commands queued by attribute writes.
+// All mode_* writes share RAZER_CMD_EFFECT, since only one effect can be
+// active at a time.
+enum razer_cmd_type {
+	RAZER_CMD_BRIGHTNESS,
+	RAZER_CMD_LOGO,
+	RAZER_CMD_FN_MODE,
+	RAZER_CMD_EFFECT,
+	RAZER_CMD_COUNT
+};
+
+enum razer_effect {
+	RAZER_EFFECT_NONE,
+	RAZER_EFFECT_STATIC,
+	RAZER_EFFECT_CUSTOM,
+	RAZER_EFFECT_WAVE,
+	RAZER_EFFECT_SPECTRUM,
+	RAZER_EFFECT_REACTIVE,
+	RAZER_EFFECT_STARLIGHT,
+	RAZER_EFFECT_BREATH
+};
+
+// Interactive lane: commands served between the rows of a frame upload.
+// Effects stay in order with the frames, since a frame switches the device
+// back to custom mode. Calls of razer_queue_call serve it before they run.
+#define RAZER_CMD_INTERACTIVE  (BIT(RAZER_CMD_BRIGHTNESS) | \
+				BIT(RAZER_CMD_LOGO) | \
+				BIT(RAZER_CMD_FN_MODE))
+
+struct razer_cmd {
+	enum razer_effect effect;    // Only used by RAZER_CMD_EFFECT.
+	unsigned char     args[RAZER_CMD_ARGS_MAX];
+	size_t            len;
+};
+
+// Queue of pending commands executed by the device workqueue.
+// A command replaces a pending command of the same type, but keeps its
+// position in the queue. All fields except work are protected by lock.
+struct razer_cmd_queue {
+	spinlock_t          lock;
+	struct work_struct  work;
+	struct razer_device *razer_dev;
+	unsigned long       pending;                 // Bitmap of queued types.
+	unsigned char       order[RAZER_CMD_COUNT];  // FIFO of queued types.
+	unsigned int        order_len;
+	struct razer_cmd    cmds[RAZER_CMD_COUNT];
+	int                 error;                   // First error since flush.
+};
+
+// Function run on the device workqueue by razer_queue_call for callers
+// which need the result. done is completed once fn returned.
+struct razer_call {
+	struct work_struct  work;
+	struct completion   done;
+	struct razer_device *razer_dev;
+	int                 (*fn)(struct razer_device *razer_dev, void *arg);
+	void                *arg;
+	int                 retval;
+};
+
+// Commits the latest submitted custom frame at a fixed rate.
+// Frames submitted before the previous one was committed are dropped.
+// A rate of 0 commits frames as soon as the workqueue gets to them.
+// All fields except work, razer_dev and wq are protected by lock.
+struct razer_frame_sched {
+	spinlock_t          lock;
+	struct delayed_work work;
+	struct razer_device *razer_dev;
+	struct workqueue_struct *wq;
+	unsigned char       *pending;      // Latest submitted frame.
+	unsigned char       *frame;        // Frame being sent by the worker.
+	size_t              size;
+	bool                has_pending;
+	bool                stopped;
+	unsigned int        rate;          // Commits per second. 0 = disabled.
+	unsigned long       last_commit;   // jiffies
+	unsigned long       window_start;  // jiffies
+	unsigned int        window_frames;
+	unsigned int        fps;           // Achieved rate.
+	u64                 committed;
+	u64                 dropped;
+};
+
+// Software effects rendered by the kernel.
+enum razer_fx_type {
+	RAZER_FX_NONE,
+	RAZER_FX_GRADIENT,
+	RAZER_FX_PULSE,
+	RAZER_FX_SCROLL,
+	RAZER_FX_WAVE,
+	RAZER_FX_RIPPLE,
+	RAZER_FX_FADE,
+	RAZER_FX_COUNT
+};
+
+// Parameters of a software effect.
+// fg, bg:      Colors mixed by the effect.
+// period_ms:   Duration of one cycle, of one scroll step, or of the
+//              reaction to a key press. 0 renders a static gradient once.
+// row, column: Center of the pulse.
+// bitmap:      Scrolled columns, bit 0 is the top row.
+struct razer_fx {
+	enum razer_fx_type type;
+	struct razer_rgb   fg;
+	struct razer_rgb   bg;
+	unsigned int       period_ms;
+	unsigned int       row;
+	unsigned int       column;
+	unsigned char      bitmap[RAZER_FX_BITMAP_MAX];
+	unsigned int       bitmap_len;
+};
+
+// A key press seen by the reactive effects.
+struct razer_fx_press {
+	unsigned long time;  // jiffies
+	unsigned char row;
+	unsigned char column;
+	bool          used;
+};
+
+// Renders the active software effect on every frame tick and submits it
+// to the frame scheduler, so animations need no userspace wakeups.
+// Key presses are recorded from interrupt context and kick a tick at once.
+// All fields except work, razer_dev, wq, keymap and the press fields are
+// protected by lock. The press fields are protected by press_lock.
+struct razer_fx_engine {
+	struct mutex        lock;
+	struct delayed_work work;
+	struct razer_device *razer_dev;
+	struct workqueue_struct *wq;
+	struct razer_fx     fx;
+	unsigned long       start;     // jiffies when the effect started.
+	unsigned char       *canvas;   // Rendered frame. NULL if unsupported.
+	unsigned int        rows;
+	unsigned int        columns;
+	bool                stopped;
+
+	unsigned char         keymap[256];  // HID usage to matrix position.
+	spinlock_t            press_lock;
+	bool                  reactive;     // A reactive effect is running.
+	unsigned int          press_next;
+	struct razer_fx_press presses[RAZER_FX_PRESSES];
+};
+
+enum razer_anim_state {
+	RAZER_ANIM_STOPPED,
+	RAZER_ANIM_PLAYING,
+	RAZER_ANIM_PAUSED
+};
+
+// Plays a stored animation without userspace wakeups. An hrtimer ends
+// each frame and queues the work, which submits the next frame to the
+// frame scheduler.
+// durations: vmalloc'd count frame durations in ms, followed by the
+//            count frames.
+// position:  Frame shown, or shown next while stopped.
+// remaining: Time left of the frame while paused.
+// expired:   The timer ended the frame shown. Set by the timer.
+// All fields except timer, work, razer_dev, wq and expired are protected
+// by lock.
+struct razer_anim_player {
+	struct mutex        lock;
+	struct hrtimer      timer;
+	struct work_struct  work;
+	struct razer_device *razer_dev;
+	struct workqueue_struct *wq;
+	u32                 *durations;
+	unsigned char       *frames;
+	size_t              frame_size;
+	unsigned int        count;
+	unsigned int        flags;      // RAZER_ANIM_*
+	unsigned int        position;
+	enum razer_anim_state state;
+	ktime_t             remaining;
+	bool                expired;
+	bool                stopped;
+};
+
 struct razer_data {
+	const struct razer_model *model;
+	struct device            *dev;   // The bound HID device.
+
+	// Restores the device states after probe and resume.
+	struct work_struct init_work;
+	bool               ready;        // init_work finished.
+
 	char macro_keys_state;
 	char fn_mode_state;
+
+	// Shadow copy of the last committed key colors frame.
+	// Only rows and columns differing from it are sent to the device.
+	// With deferred responses, the last rows of a frame are confirmed
+	// later. A deferred failure since key_colors_failures invalidates it.
+	struct mutex  key_colors_lock;
+	unsigned char *key_colors;
+	bool          key_colors_valid;
+	unsigned int  key_colors_failures;
+
+	// Cached device information, so reads cause no USB traffic.
+	// Protected by cache_lock, which is never held during USB I/O.
+	struct mutex cache_lock;
+	char         fw_version[16];  // Empty if unknown.
+	char         serial[64];
+	int          brightness;      // Smaller than 0 if unknown.
+
+	struct razer_fb *fb;   // Optional framebuffer device.
+
+	// Ordered workqueue running all USB I/O triggered by attribute writes.
+	struct workqueue_struct  *wq;
+	struct razer_cmd_queue   queue;
+	struct razer_frame_sched sched;
+	struct razer_fx_engine   fx;
+	struct razer_anim_player anim;
+
+	struct list_head node;  // Entry of the bound devices list.
 };
 
+//#################//
+//### Functions ###//
+//#################//
+
+void razer_queue_run(struct razer_cmd_queue *queue, unsigned long mask);
+bool razer_queue_preempt(struct razer_device *razer_dev, void *context);
+int razer_queue_call(struct razer_device *razer_dev,
+		     int (*fn)(struct razer_device *razer_dev, void *arg),
+		     void *arg);
+
+void razer_fx_stop(struct razer_fx_engine *engine);
+void razer_anim_stop(struct razer_anim_player *player);
+
 #endif // __HID_RAZER_H